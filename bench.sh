@@ -0,0 +1,92 @@
+#!/bin/sh
+# Runs every pattern at every thread count on a board and compares the
+# bandwidth achieved with that board's stored baseline.
+# Usage: ./bench.sh [-u] MACHINE
+#   -u  Record this run as the new baseline instead of comparing against it
+# Environment: BINARY (default thrasher), DURATION in seconds (default 5),
+# THREADS (default 1 up to the board's core count), TOLERANCE as the percent
+# drop that counts as a regression (default 5), BOARD (default MACHINE's
+# short host name) and BASELINES (default bench/).
+set -eu
+
+update=0
+if [ "${1:-}" = "-u" ]; then
+    update=1
+    shift
+fi
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 [-u] MACHINE" >&2
+    exit 1
+fi
+machine=$1
+binary=${BINARY:-thrasher}
+duration=${DURATION:-5}
+tolerance=${TOLERANCE:-5}
+board=${BOARD:-${machine%%.*}}
+baselines=${BASELINES:-bench}
+patterns="rmw write read chase bank random random-read random-write prefetch rmw-prefetch clean"
+
+remote() {
+    ssh "root@$machine" "$@"
+}
+
+scp "$binary" "root@$machine:/tmp/thrasher"
+threads=${THREADS:-$(seq 1 "$(remote nproc)")}
+kernel=$(remote uname -r)
+
+mkdir -p "$baselines"
+raw=$baselines/$board.json
+results=$(mktemp)
+trap 'rm -f "$results"' EXIT
+: > "$raw"
+
+for pattern in $patterns; do
+    for t in $threads; do
+        echo "$pattern with $t thread(s)..." >&2
+        remote /tmp/thrasher --format json --duration "$duration" -t "$t" -p "$pattern" 2>/dev/null >> "$raw"
+    done
+done
+
+# One line per run: pattern, threads and the sum of what each worker achieved
+# while sweeping, which leaves set-up time out of the figure.
+{
+    echo "# kernel $kernel, thrasher $(git describe --always --dirty 2>/dev/null || echo unknown)"
+    awk '{
+        pattern = $0; sub(/^\{"pattern":"/, "", pattern); sub(/".*/, "", pattern)
+        threads = $0; sub(/.*"threads":/, "", threads); sub(/,.*/, "", threads)
+        rest = $0; sub(/.*"workers":\[/, "", rest)
+        total = 0
+        while (match(rest, /"mb_s":[0-9.]+/)) {
+            total += substr(rest, RSTART + 7, RLENGTH - 7)
+            rest = substr(rest, RSTART + RLENGTH)
+        }
+        printf "%s %s %.1f\n", pattern, threads, total
+    }' "$raw"
+} > "$results"
+
+baseline=$baselines/$board.baseline
+if [ $update -eq 1 ] || [ ! -f "$baseline" ]; then
+    cp "$results" "$baseline"
+    echo "Recorded baseline for $board in $baseline" >&2
+    exit 0
+fi
+
+echo "Comparing with $(head -n 1 "$baseline" | sed 's/^# //')" >&2
+awk -v tolerance="$tolerance" '
+    /^#/ { next }
+    NR == FNR { base[$1 " " $2] = $3; next }
+    {
+        key = $1 " " $2
+        if (!(key in base)) {
+            printf "%-13s %2s threads: %9.1fMB/s (no baseline)\n", $1, $2, $3
+            next
+        }
+        change = base[key] > 0 ? ($3 - base[key]) * 100 / base[key] : 0
+        flag = change < -tolerance ? "  REGRESSION" : ""
+        if (flag != "")
+            failed = 1
+        printf "%-13s %2s threads: %9.1fMB/s vs %9.1fMB/s (%+.1f%%)%s\n",
+               $1, $2, $3, base[key], change, flag
+    }
+    END { exit failed }
+' "$baseline" "$results"
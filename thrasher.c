@@ -4,62 +4,3112 @@
  * Description: This program is designed to stress the i.MX6 Quad memory bus
  * and controller as much as possible by purposely generating cache misses.
  */
+#define _GNU_SOURCE
+// /dev/mem offsets above 2GiB need a 64-bit off_t on 32-bit ARM
+#define _FILE_OFFSET_BITS 64
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <limits.h>
 #include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "thrasher.h"
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT 4 // Linux 4.4, missing from older C libraries
+#endif
 
-// L1 is 4-way
+// L1 is 4-way, L2 is 16-way
+// These are only defaults for when the geometry cannot be detected at runtime,
+// and each Makefile target overrides them for the part it builds for.
+#ifndef LINE_SIZE
 #define LINE_SIZE 32 // 8 32-bit words per line in L1 & L2; 32 bytes
-#define L2_SIZE 16*2048*32 // 16 ways, 2048 lines/way, 32 bytes/line
+#endif
+#ifndef L2_SIZE
+#define L2_SIZE (16*2048*32) // 16 ways, 2048 lines/way, 32 bytes/line
+#endif
+#ifndef L2_WAYS
+#define L2_WAYS 16
+#endif
 
 // Each piece of data can go in one of 16 ways
 // Which bits do what?
 // [ NC  | bank | ...  |  way  |  line  |  byte  ]
 //  31 30 29  27        19   16 15     5 4      0
 
-int main(int argc, char** argv) {
-    if (argc >= 2 && (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0)) {
-        fprintf(stderr, "Usage: %s [number of iterations]\n", argv[0]);
-        fprintf(stdout, "Program will iterate forever if the number of iterations is not specified.");
+// Within a bank, DRAM rows sit directly above the 8KB of columns that one
+// row of a 64-bit wide DDR3 rank covers. Both positions can be overridden.
+#define BANK_SHIFT 27
+#define NUM_BANKS 8
+#define ROW_SHIFT 13
+
+// Sweeps are issued in chunks of this many bytes, which is how finely the
+// rate limiter can space out traffic. It must divide the buffer size.
+#define CHUNK_SIZE (64*1024)
+// Full-speed sweeps used to measure the peak rate for --duty
+#define CALIBRATION_SWEEPS 8
+// How long each --calibrate trial runs for, unless --duration says otherwise
+#define TRIAL_SECONDS "0.25"
+// Lines rmw-prefetch prefetches ahead, unless --prefetch-distance says otherwise
+#define PREFETCH_LINES 8
+
+#define CACHE_SYSFS "/sys/devices/system/cpu/cpu0/cache"
+
+// The default huge page size with LPAE on ARM, and on aarch64 and x86
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+// Where progress messages go: stdout, unless that carries --format records
+static FILE* info;
+
+// Where worker buffers come from
+enum alloc_mode {
+    ALLOC_ANON, // Anonymous mmap, i.e. scattered 4KiB pages
+    ALLOC_HUGE, // hugetlbfs pages, or transparent huge pages failing that
+    ALLOC_PHYS, // A physically contiguous region reserved at boot, via /dev/mem
+    ALLOC_COLORED, // Only pages whose colour is in color_mask
+    ALLOC_UDMABUF, // A CMA buffer exported by the u-dma-buf driver
+};
+
+// How buffers carved out of a region are mapped. Uncached, every access the
+// core issues becomes its own bus transaction, and write-combined only
+// stores are merged, so DRAM sees the kernel's accesses rather than fills.
+enum cache_mode {
+    CACHE_DEFAULT,
+    CACHE_NC, // Non-cacheable, via O_SYNC
+    CACHE_WC, // Write-combined, which /dev/mem cannot provide
+};
+#ifndef THRASHER_LIBRARY
+static enum cache_mode cache_mode = CACHE_DEFAULT;
+#endif
+static enum alloc_mode alloc_mode = ALLOC_ANON;
+static int devmem_fd = -1;
+static uint64_t phys_base, phys_size, phys_used;
+
+// Pages of one colour compete for the same L2 sets: the colour is the part of
+// the set index above the page offset, bits 12-15 on the i.MX6Q.
+#define MAX_COLORS 64
+static uint64_t color_mask;
+
+// Cache geometry in use, from detect_geometry() or the command line. On parts
+// with more than two levels of cache, l2_size is the last level.
+static uint32_t line_size = LINE_SIZE;
+// The line size actually detected, which a --line-size stride may exceed
+static uint32_t cache_line = LINE_SIZE;
+static uint32_t l2_size = L2_SIZE;
+static uint32_t l2_ways = L2_WAYS;
+// Bytes swept by each worker. Kept a multiple of CHUNK_SIZE.
+static uint32_t buffer_size;
+// How far into its mapping each worker's sweep starts
+static uint32_t buffer_offset;
+
+// Indices into kernels[]
+enum pattern {
+    PATTERN_RMW,    // Read-modify-write one byte per line
+    PATTERN_WRITE,  // Overwrite every byte of every line
+    PATTERN_READ,   // Load one word per line
+    PATTERN_CHASE,  // Dependent loads through a random cycle of lines
+    PATTERN_BANK,   // Alternate between two rows of the same bank(s)
+    PATTERN_RANDOM, // Read-modify-write uniformly random lines
+    PATTERN_RANDOM_READ,  // Load one word from uniformly random lines
+    PATTERN_RANDOM_WRITE, // Overwrite uniformly random lines in full
+    PATTERN_PREFETCH, // Prefetch every line without touching it
+    PATTERN_RMW_PREFETCH, // Read-modify-write, prefetching ahead
+    PATTERN_CLEAN,  // Dirty every line, then clean it back out of the cache
+    NUM_PATTERNS
+};
+
+#define CACHE_MISS(cache) (PERF_COUNT_HW_CACHE_##cache | \
+        PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+// Events counted on each worker's own thread. On the Cortex-A9 a read miss
+// in L1D is the L1D refill event (0x03), and LL is unsupported: the L2 is
+// the PL310, which has its own system-wide counters below. DTLB read misses
+// are the data TLB refill event, which counts refills for stores too, and
+// every one of them is a translation table walk.
+enum core_event {
+    EV_CYCLES,
+    EV_INSTRUCTIONS,
+    EV_L1D_REFILL,
+    EV_LL_MISS,
+    EV_DTLB_MISS,
+    NUM_CORE_EVENTS
+};
+
+static const struct {
+    const char* name;
+    const char* key; // For machine-readable output
+    uint32_t type;
+    uint64_t config;
+} core_events[NUM_CORE_EVENTS] = {
+    [EV_CYCLES] = {"cycles", "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [EV_INSTRUCTIONS] = {"instructions", "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [EV_L1D_REFILL] = {"L1D refills", "l1d_refills", PERF_TYPE_HW_CACHE, CACHE_MISS(L1D)},
+    [EV_LL_MISS] = {"LL misses", "ll_misses", PERF_TYPE_HW_CACHE, CACHE_MISS(LL)},
+    [EV_DTLB_MISS] = {"DTLB misses", "dtlb_misses", PERF_TYPE_HW_CACHE, CACHE_MISS(DTLB)},
+};
+
+// The PL310 event counters, as exposed by the l2x0 PMU driver. It only has
+// two, so count requests and hits of whichever direction the pattern uses.
+#define L2C_PMU "/sys/bus/event_source/devices/l2c_310"
+
+// Sampled access latencies are kept in log2 groups of HIST_SUB linear
+// buckets each, so every bucket is within 1/HIST_SUB of its value all the way
+// up to UINT32_MAX ticks, without allocating. Values below HIST_SUB are exact.
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+// Per-thread state. Each worker owns a private buffer so that no two cores
+// ever hit on each other's lines in the shared L2.
+struct worker {
+    pthread_t thread;
+    int cpu; // -1 if the worker should not be pinned
+    uint8_t* buffer;
+    uint8_t* base; // Start of the mapping holding buffer, for freeing it
+    enum pattern pattern;
+    void (*run)(struct worker* w, uint32_t begin, uint32_t end); // Variant to sweep with
+    uint32_t iterations;
+    bool infinite;
+    bool prompt; // Stop between chunks even when not paced
+    uint32_t iteration; // Sweep in progress, for kernels that need it
+    uint32_t seed; // Kernel PRNG state
+    uintptr_t sink; // Result of loads, kept so they cannot be optimised out
+    void* chase; // Current position in the pointer-chasing cycle
+    uint32_t prefetch_lines; // How far ahead rmw-prefetch prefetches
+    // Bank-conflict addressing. Offsets are relative to the shared span.
+    uint32_t bank_offset[NUM_BANKS];
+    uint32_t num_banks;
+    uint32_t row_shift;
+    uint32_t row_base; // First row this worker may use in every bank
+    uint32_t row_pairs; // Rows used per sweep, in pairs
+    bool baseline; // Measure the rmw kernel first, for comparison
+    double baseline_rate; // Bytes/s that rmw achieved
+    // Rate limiting. A chunk_ns of 0 runs flat out.
+    double rate; // Target bytes/s, or 0 to derive it from duty
+    double duty; // Fraction of this worker's own peak rate
+    bool sleep; // Wait with clock_nanosleep instead of spinning
+    int fifo; // SCHED_FIFO priority to run at, or 0 to stay with the default
+    uint64_t chunk_ns;
+    uint64_t next_ns;
+    // Timing, filled in by the worker as it runs. Only sweeps is updated
+    // atomically, as the reporter thread samples it while the worker runs.
+    uint64_t sweeps;
+    uint64_t elapsed_ns;
+    uint64_t sweep_min_ns;
+    uint64_t sweep_max_ns;
+    uint64_t idle_ns; // Spent waiting between bursts, within elapsed_ns
+    // What the sweep in progress had covered when a stop cut it short
+    uint32_t partial_bytes;
+    uint64_t partial_ns;
+    // Hardware counters, or -1 where the event could not be opened
+    bool pmu;
+    int pmu_fd[NUM_CORE_EVENTS];
+    const int* l2c_fd; // PL310 counters this worker enables, on one worker only
+    uint64_t pmu_count[NUM_CORE_EVENTS];
+    // Latency sampling: every sample_lines-th access is timed on its own
+    uint32_t sample_lines; // 0 to never sample
+    void (*sample_run)(struct worker* w, uint32_t begin, uint32_t end); // Generic variant, for single accesses
+    uint64_t timer_overhead; // Ticks a timed empty run takes, subtracted
+    uint64_t samples;
+    uint64_t sample_max;
+    uint64_t hist[HIST_BUCKETS];
+};
+
+static uint32_t xorshift32(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// The widest store the target has, for filling whole lines
+#ifdef __ARM_NEON
+typedef uint8x16_t line_word_t;
+static inline line_word_t line_word_dup(uint8_t x) { return vdupq_n_u8(x); }
+static inline void line_word_store(uint8_t* p, line_word_t v) { vst1q_u8(p, v); }
+#elif defined(__SSE2__)
+typedef __m128i line_word_t;
+static inline line_word_t line_word_dup(uint8_t x) { return _mm_set1_epi8((char)x); }
+static inline void line_word_store(uint8_t* p, line_word_t v) { _mm_storeu_si128((__m128i*)p, v); }
+#else
+typedef uint64_t line_word_t;
+static inline line_word_t line_word_dup(uint8_t x) { return x * 0x0101010101010101ull; }
+static inline void line_word_store(uint8_t* p, line_word_t v) { *(uint64_t*)p = v; }
+#endif
+
+static inline void store_line(uint8_t* p, line_word_t v, uint32_t stride) {
+    for (uint32_t j = 0; j < stride; j += sizeof(v))
+        line_word_store(p + j, v);
+}
+
+// Memory traffic per access: one line, or the stride where that is shorter.
+// A stride beyond the line, e.g. --line-size page, still only moves a line.
+static uint32_t access_size(void) {
+    return line_size < cache_line ? line_size : cache_line;
+}
+
+// Traffic generated by sweeping the given number of bytes
+static double traffic(double swept) {
+    return swept / line_size * access_size();
+}
+
+// The streaming kernels below are each written as the locals they need at
+// stride s, one access to byte i of buffer b, and how to save the locals back
+// once the chunk is done. DEFINE_KERNEL() then turns that into the loops.
+
+// The original pattern: touch one byte per line, dirtying every line so that
+// each miss also costs a write-back on eviction.
+#define RMW_LOCALS(s) (void)0
+#define RMW_ACCESS(b, i, s) ((b)[i]++)
+#define RMW_SAVE (void)0
+
+// Fill every line in full without ever reading it. As no word of a line
+// survives, the PL310 can allocate on write instead of filling from DRAM
+// first, so this measures write bandwidth on its own. Strides beyond a line
+// fill only the line at the start of each, like the other patterns.
+#define WRITE_LOCALS(s) line_word_t v = line_word_dup(w->iteration); \
+    const uint32_t fill = (s) < cache_line ? (s) : cache_line
+#define WRITE_ACCESS(b, i, s) store_line((b) + (i), v, fill)
+#define WRITE_SAVE (void)0
+
+// Clean line fills only, with no write-back traffic at all
+#define READ_LOCALS(s) uintptr_t sum = 0
+#define READ_ACCESS(b, i, s) (sum += *(const uintptr_t*)((b) + (i)))
+#define READ_SAVE (w->sink += sum)
+
+// As many accesses per chunk as there are lines in it, each to a line drawn
+// uniformly from the whole buffer. Scaling the random word by the line
+// count, rather than taking a modulus, keeps this to one multiply and works
+// for any buffer size, not just powers of two. RANDOM_LINE() is the offset
+// of the next line, shared by the rmw, read and write variants.
+#define RANDOM_LOCALS(s) const uint64_t lines = buffer_size / (s); uint32_t seed = w->seed
+#define RANDOM_LINE(s) ((uint32_t)(xorshift32(&seed) * lines >> 32) * (s))
+#define RANDOM_ACCESS(b, i, s) ((b)[RANDOM_LINE(s)]++)
+#define RANDOM_SAVE (w->seed = seed)
+
+#define RANDOM_READ_LOCALS(s) RANDOM_LOCALS(s); uintptr_t sum = 0
+#define RANDOM_READ_ACCESS(b, i, s) (sum += *(const uintptr_t*)((b) + RANDOM_LINE(s)))
+#define RANDOM_READ_SAVE (RANDOM_SAVE, w->sink += sum)
+
+#define RANDOM_WRITE_LOCALS(s) RANDOM_LOCALS(s); WRITE_LOCALS(s)
+#define RANDOM_WRITE_ACCESS(b, i, s) store_line((b) + RANDOM_LINE(s), v, fill)
+#define RANDOM_WRITE_SAVE RANDOM_SAVE
+
+// Only prefetch, never load or store: PLD on ARM. A prefetch does not hold
+// up the core the way a missing load does, so many more line fills can be
+// outstanding at once than the load/store unit alone can track.
+#define PREFETCH_LOCALS(s) (void)0
+#define PREFETCH_ACCESS(b, i, s) __builtin_prefetch((b) + (i))
+#define PREFETCH_SAVE (void)0
+
+// rmw with a prefetch issued some lines ahead of every access. Prefetches
+// beyond the end of the buffer are harmless, as PLD never faults.
+#define RMW_PREFETCH_LOCALS(s) const uint32_t ahead = w->prefetch_lines * (s)
+#define RMW_PREFETCH_ACCESS(b, i, s) (__builtin_prefetch((b) + (i) + ahead), (b)[i]++)
+#define RMW_PREFETCH_SAVE (void)0
+
+typedef void (*run_fn)(struct worker* w, uint32_t begin, uint32_t end);
+
+// Strides with an unrolled variant of every streaming kernel, smallest first.
+// These issue UNROLL accesses per loop iteration, so that the loop branch and
+// induction update are amortised and more line fills are kept in flight.
+#ifndef UNROLL
+#define UNROLL 8
+#endif
+#define NUM_STRIDES 3
+#define MIN_STRIDE 32u
+_Static_assert(CHUNK_SIZE % ((MIN_STRIDE << (NUM_STRIDES - 1)) * UNROLL) == 0,
+               "Chunks must hold a whole number of unrolled iterations");
+
+#define DEFINE_UNROLLED(kernel, KERNEL, S)                                      \
+    static void kernel##_run_##S(struct worker* w, uint32_t begin, uint32_t end) { \
+        uint8_t* buffer = w->buffer;                                            \
+        KERNEL##_LOCALS(S);                                                     \
+        for (uint32_t i = begin; i < end; i += S * UNROLL) {                    \
+            _Pragma("GCC unroll 16")                                            \
+            for (uint32_t u = 0; u < UNROLL; u++)                               \
+                KERNEL##_ACCESS(buffer, i + u * S, S);                          \
+        }                                                                       \
+        KERNEL##_SAVE;                                                          \
+    }
+
+// The generic variant steps by whatever line size is in use. Stores through
+// buffer may alias the global, so it is read exactly once.
+#define DEFINE_KERNEL(kernel, KERNEL)                                           \
+    static void kernel##_run(struct worker* w, uint32_t begin, uint32_t end) {  \
+        uint8_t* buffer = w->buffer;                                            \
+        const uint32_t stride = line_size;                                      \
+        KERNEL##_LOCALS(stride);                                                \
+        for (uint32_t i = begin; i < end; i += stride)                          \
+            KERNEL##_ACCESS(buffer, i, stride);                                 \
+        KERNEL##_SAVE;                                                          \
+    }                                                                           \
+    DEFINE_UNROLLED(kernel, KERNEL, 32)                                         \
+    DEFINE_UNROLLED(kernel, KERNEL, 64)                                         \
+    DEFINE_UNROLLED(kernel, KERNEL, 128)
+
+#define UNROLLED(kernel) {kernel##_run_32, kernel##_run_64, kernel##_run_128}
+
+DEFINE_KERNEL(rmw, RMW)
+DEFINE_KERNEL(write, WRITE)
+DEFINE_KERNEL(read, READ)
+DEFINE_KERNEL(random, RANDOM)
+DEFINE_KERNEL(random_read, RANDOM_READ)
+DEFINE_KERNEL(random_write, RANDOM_WRITE)
+DEFINE_KERNEL(prefetch, PREFETCH)
+DEFINE_KERNEL(rmw_prefetch, RMW_PREFETCH)
+
+// Link every line of the buffer into one random cycle (Sattolo's algorithm)
+// by storing a pointer to the next line in the first word of each line. As
+// each load depends on the last, neither the prefetcher nor the line-fill
+// buffers can overlap misses, exposing the full DRAM latency.
+static int link_cycle(uint8_t* buffer, uint32_t lines, uint32_t* seed) {
+    uint32_t* next = malloc(lines * sizeof(uint32_t));
+    if (!next)
+        return -1;
+    for (uint32_t i = 0; i < lines; i++)
+        next[i] = i;
+    for (uint32_t i = lines - 1; i > 0; i--) {
+        uint32_t j = xorshift32(seed) % i;
+        uint32_t tmp = next[i];
+        next[i] = next[j];
+        next[j] = tmp;
+    }
+    for (uint32_t i = 0; i < lines; i++)
+        *(void**)(buffer + i * line_size) = buffer + next[i] * line_size;
+    free(next);
+    return 0;
+}
+
+static int chase_init(struct worker* w) {
+    w->chase = w->buffer;
+    return link_cycle(w->buffer, buffer_size / line_size, &w->seed);
+}
+
+// One sweep is one trip around the cycle, so that every line is loaded once.
+// A chunk is the matching fraction of the trip, wherever it happens to be.
+static void chase_run(struct worker* w, uint32_t begin, uint32_t end) {
+    void* p = w->chase;
+    for (uint32_t i = begin; i < end; i += line_size)
+        p = *(void**)p;
+    w->chase = p;
+}
+
+// Visit the same number of lines as the other patterns, but in an order where
+// consecutive accesses to a bank always open a different row: each column is
+// touched in row 2p and then row 2p+1 of every bank in turn. With more than
+// one bank selected the row buffers of all of them thrash in lockstep.
+// Chunks are rounded to whole row pairs, so some chunks may be empty.
+static void bank_run(struct worker* w, uint32_t begin, uint32_t end) {
+    uint8_t* span = w->buffer;
+    const uint32_t stride = line_size;
+    const uint32_t pair_bytes = 2 * w->num_banks << w->row_shift;
+    const uint32_t last = end / pair_bytes < w->row_pairs ? end / pair_bytes : w->row_pairs;
+    for (uint32_t p = begin / pair_bytes; p < last; p++) {
+        uint32_t row = (w->row_base + 2 * p) << w->row_shift;
+        for (uint32_t c = 0; c < 1u << w->row_shift; c += stride) {
+            for (uint32_t b = 0; b < w->num_banks; b++) {
+                uint8_t* base = span + w->bank_offset[b] + c;
+                base[row]++;
+                base[row + (1u << w->row_shift)]++;
+            }
+        }
+    }
+}
+
+// Write lines [p, end) back by virtual address, leaving them valid. aarch64
+// lets user space clean to the point of coherency, i.e. DRAM, directly. x86
+// only has a clean that also invalidates short of CLWB. 32-bit ARM has to
+// ask the kernel, and the cacheflush syscall behind __builtin___clear_cache
+// only cleans the L1 to the point of unification, which on the A9 is the
+// PL310: nothing reaches DRAM until the PL310 evicts the lines itself.
+static inline void clean_range(uint8_t* p, uint8_t* end, uint32_t stride) {
+#if defined(__aarch64__)
+    for (; p < end; p += stride)
+        __asm__ volatile("dc cvac, %0" : : "r"(p) : "memory");
+#elif defined(__SSE2__)
+    for (; p < end; p += stride)
+        _mm_clflush(p);
+#else
+    (void)stride;
+    __builtin___clear_cache((char*)p, (char*)end);
+#endif
+}
+
+// Dirty every line in the chunk in full, as the write pattern does, so that
+// no line needs filling first, then force all of them out with cache
+// maintenance rather than waiting for evictions. On aarch64, where the clean
+// reaches DRAM without invalidating, a buffer that fits in the cache
+// (--multiplier 1 or less) makes every sweep pure write-back traffic. On
+// 32-bit ARM the buffer has to outgrow the PL310 for any to reach DRAM, and
+// then it is the PL310's evictions that carry it.
+static void clean_run(struct worker* w, uint32_t begin, uint32_t end) {
+    uint8_t* buffer = w->buffer;
+    const uint32_t stride = line_size;
+    const uint32_t fill = stride < cache_line ? stride : cache_line;
+    const line_word_t v = line_word_dup(w->iteration);
+    for (uint32_t i = begin; i < end; i += stride)
+        store_line(buffer + i, v, fill);
+    clean_range(buffer + begin, buffer + end, stride);
+}
+
+// One kernel per access pattern. run() issues one chunk, bytes [begin, end)
+// of the sweep, and must stay a tight loop: it is only ever called through
+// the pointer once per chunk, never per access. The optional init() runs on
+// the main thread once the buffer exists, and teardown() once all workers
+// have stopped. Kernels whose accesses are independent also provide
+// unrolled variants; chase and bank gain nothing from them, as every chase
+// load waits on the last and bank already issues a batch per column, and
+// neither does clean, which is bound by its write-backs.
+struct kernel {
+    const char* name;
+    int (*init)(struct worker* w);
+    run_fn run;
+    void (*teardown)(struct worker* w);
+    run_fn unrolled[NUM_STRIDES]; // For MIN_STRIDE << index
+};
+
+static const struct kernel kernels[NUM_PATTERNS] = {
+    [PATTERN_RMW] = {"rmw", NULL, rmw_run, NULL, UNROLLED(rmw)},
+    [PATTERN_WRITE] = {"write", NULL, write_run, NULL, UNROLLED(write)},
+    [PATTERN_READ] = {"read", NULL, read_run, NULL, UNROLLED(read)},
+    [PATTERN_CHASE] = {"chase", chase_init, chase_run, NULL, {NULL}},
+    [PATTERN_BANK] = {"bank", NULL, bank_run, NULL, {NULL}},
+    [PATTERN_RANDOM] = {"random", NULL, random_run, NULL, UNROLLED(random)},
+    [PATTERN_RANDOM_READ] = {"random-read", NULL, random_read_run, NULL, UNROLLED(random_read)},
+    [PATTERN_RANDOM_WRITE] = {"random-write", NULL, random_write_run, NULL, UNROLLED(random_write)},
+    [PATTERN_PREFETCH] = {"prefetch", NULL, prefetch_run, NULL, UNROLLED(prefetch)},
+    [PATTERN_RMW_PREFETCH] = {"rmw-prefetch", NULL, rmw_prefetch_run, NULL, UNROLLED(rmw_prefetch)},
+    [PATTERN_CLEAN] = {"clean", NULL, clean_run, NULL, {NULL}},
+};
+
+// The unrolled variant of a kernel for the current line size, if it has one
+static run_fn select_run(const struct kernel* k) {
+    for (int v = 0; v < NUM_STRIDES; v++)
+        if (line_size == MIN_STRIDE << v && k->unrolled[v])
+            return k->unrolled[v];
+    return k->run;
+}
+
+static enum pattern find_pattern(const char* name) {
+    enum pattern p;
+    for (p = 0; p < NUM_PATTERNS; p++)
+        if (strcmp(name, kernels[p].name) == 0)
+            break;
+    return p;
+}
+
+// What only the command line uses, here and in the #ifndef THRASHER_LIBRARY
+// blocks further on, is left out of the library build
+#ifndef THRASHER_LIBRARY
+// What one --worker asks for. Anything left out follows the global options.
+struct worker_spec {
+    int cpu; // -1 to place the worker as --threads would
+    enum pattern pattern; // NUM_PATTERNS for --pattern's
+    double rate; // MB/s, or 0
+    double duty; // Percent, or 0
+};
+
+// Parse a comma-separated list of key=value pairs, e.g. cpu=1,pattern=bank
+static int parse_worker_spec(const char* arg, struct worker_spec* spec) {
+    char* copy = strdup(arg);
+    char* rest = copy;
+    int ret = copy ? 0 : -1;
+    *spec = (struct worker_spec){.cpu = -1, .pattern = NUM_PATTERNS};
+    for (char* field; ret == 0 && (field = strsep(&rest, ",")) != NULL;) {
+        char* value = strchr(field, '=');
+        char* status = NULL;
+        if (!value) {
+            ret = -1;
+            break;
+        }
+        *value++ = '\0';
+        if (strcmp(field, "cpu") == 0) {
+            long cpu = strtol(value, &status, 10);
+            spec->cpu = cpu;
+            if (cpu < 0 || cpu >= CPU_SETSIZE)
+                ret = -1;
+        } else if (strcmp(field, "pattern") == 0) {
+            spec->pattern = find_pattern(value);
+            if (spec->pattern == NUM_PATTERNS)
+                ret = -1;
+        } else if (strcmp(field, "rate") == 0) {
+            spec->rate = strtod(value, &status);
+            if (spec->rate <= 0)
+                ret = -1;
+        } else if (strcmp(field, "duty") == 0) {
+            spec->duty = strtod(value, &status);
+            if (spec->duty <= 0 || spec->duty > 100)
+                ret = -1;
+        } else {
+            ret = -1;
+        }
+        if (status && (status == value || status[0] != '\0'))
+            ret = -1;
+    }
+    if (spec->rate && spec->duty)
+        ret = -1;
+    free(copy);
+    return ret;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [options] [number of iterations]\n", name);
+    fprintf(stderr, "  -t, --threads N  Run N workers, each pinned to its own core\n");
+    fprintf(stderr, "  -p, --pattern P  Access pattern:");
+    for (int p = 0; p < NUM_PATTERNS; p++)
+        fprintf(stderr, "%s %s%s", p ? "," : "", kernels[p].name, p == PATTERN_RMW ? " (default)" : "");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  --worker SPEC    Add a worker as given by cpu=N,pattern=P,rate=MBPS,duty=PERCENT, any\n");
+    fprintf(stderr, "                   of which may be left out; repeat for each worker, instead of --threads\n");
+    fprintf(stderr, "  --prefetch-distance N  Lines rmw-prefetch prefetches ahead (default %d)\n", PREFETCH_LINES);
+    fprintf(stderr, "  --baseline       Measure the rmw pattern first and report against it\n");
+    fprintf(stderr, "  --bank-mask M    Banks the bank pattern may use (default 0xff)\n");
+    fprintf(stderr, "  --bank-shift S   Lowest address bit selecting the bank (default %d)\n", BANK_SHIFT);
+    fprintf(stderr, "  --row-shift S    Lowest address bit selecting the row (default %d)\n", ROW_SHIFT);
+    fprintf(stderr, "  --report-interval MS  Print the bandwidth achieved every MS milliseconds\n");
+    fprintf(stderr, "  --report-file PATH    Write those samples to PATH as CSV instead\n");
+    fprintf(stderr, "  --rate MBPS      Limit all workers together to MBPS MB/s\n");
+    fprintf(stderr, "  --duty PERCENT   Limit each worker to PERCENT of its measured peak rate\n");
+    fprintf(stderr, "  --duration SECS  Stop after SECS seconds, whatever the number of iterations\n");
+    fprintf(stderr, "  --pace MODE      Wait between chunks by spinning (spin, default) or sleeping (sleep)\n");
+    fprintf(stderr, "  --burst K:MS     Every MS milliseconds, have all workers run K sweeps together\n");
+    fprintf(stderr, "  --fifo PRIO      Run workers under SCHED_FIFO at priority PRIO\n");
+    fprintf(stderr, "  --mlock          Lock all memory, so that nothing is paged out mid-run\n");
+    fprintf(stderr, "  --line-size N    Stride between accesses (default: detected line size), or page\n");
+    fprintf(stderr, "                   to touch a new page with every access\n");
+    fprintf(stderr, "  --l2-size N      Size of the last-level cache (default: detected)\n");
+    fprintf(stderr, "  --multiplier X   Size buffers at X times the last-level cache (default 4)\n");
+    fprintf(stderr, "  --size N         Size buffers at N bytes instead, e.g. 256M to reach past the TLB\n");
+    fprintf(stderr, "  --offset N       Start each sweep N bytes into its buffer\n");
+    fprintf(stderr, "  --colors LIST    Build buffers only from pages of these L2 colours, e.g. 0,4-7\n");
+    fprintf(stderr, "  --hugepages      Back buffers with huge pages to take TLB misses out of the picture\n");
+    fprintf(stderr, "  --phys ADDR:SIZE Carve buffers out of a reserved physical region via /dev/mem\n");
+    fprintf(stderr, "  --udmabuf NAME   Carve buffers out of the u-dma-buf device NAME, e.g. udmabuf0\n");
+    fprintf(stderr, "  --uncached MODE  Map those buffers non-cacheable (nc) or write-combined (wc)\n");
+    fprintf(stderr, "  --pmu            Count cache misses with the hardware performance counters\n");
+    fprintf(stderr, "  --sample N       Time every Nth access and report latency percentiles\n");
+    fprintf(stderr, "  --victim         Measure how much 1-3 thrashers of each pattern slow a fixed workload\n");
+    fprintf(stderr, "  --calibrate      Try each pattern, stride, multiplier and thread count for --duration\n");
+    fprintf(stderr, "                   (default %ss) and print the one with the most bandwidth, in cache\n", TRIAL_SECONDS);
+    fprintf(stderr, "                   misses with --pmu, or with --victim the one slowing the victim most\n");
+    fprintf(stderr, "  --save-config PATH  Save what --calibrate found to PATH\n");
+    fprintf(stderr, "  --config PATH    Load options from PATH, as saved by --save-config; the\n");
+    fprintf(stderr, "                   command line's own options take precedence\n");
+    fprintf(stderr, "  --format F       Print results as text (default), json or csv, one record per run\n");
+    fprintf(stderr, "                   or per sample with --report-interval; other messages go to stderr\n");
+    fprintf(stderr, "  -h, --help       Show this message\n");
+    fprintf(stdout, "Program will iterate forever if the number of iterations is not specified.\n");
+    fprintf(stdout, "With --victim, the number instead sets how many runs each measurement is the median of.\n");
+}
+#endif
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Parse a byte count with an optional K, M or G suffix
+static int parse_size(const char* str, uint64_t* out) {
+    char* status;
+    unsigned long long size = strtoull(str, &status, 10);
+    switch (status[0]) {
+    case 'G': case 'g': size <<= 10; // fall through
+    case 'M': case 'm': size <<= 10; // fall through
+    case 'K': case 'k': size <<= 10; status++; // fall through
+    case '\0': break;
+    default: return -1;
+    }
+    if (status[0] != '\0' || size == 0)
+        return -1;
+    *out = size;
+    return 0;
+}
+
+// Read a whole sysfs attribute without its trailing newline
+static int sysfs_read(const char* path, char* buf, size_t len) {
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return -1;
+    bool ok = fgets(buf, len, f) != NULL;
+    fclose(f);
+    if (!ok)
+        return -1;
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+// Find the line size and size of the last data or unified cache level,
+// trying sysfs, then glibc, then the cache type register where userspace may
+// read it. Returns where the geometry came from, or NULL to keep the defaults.
+static const char* detect_geometry(uint32_t* line, uint32_t* size, uint32_t* ways) {
+    unsigned best_level = 0;
+    uint32_t best_ways = 0;
+    for (int i = 0; ; i++) {
+        char path[128], buf[32];
+        unsigned level;
+        uint64_t bytes, coherency;
+        snprintf(path, sizeof(path), CACHE_SYSFS "/index%d/type", i);
+        if (sysfs_read(path, buf, sizeof(buf)) != 0)
+            break;
+        if (strcmp(buf, "Instruction") == 0)
+            continue;
+        snprintf(path, sizeof(path), CACHE_SYSFS "/index%d/level", i);
+        if (sysfs_read(path, buf, sizeof(buf)) != 0 || sscanf(buf, "%u", &level) != 1)
+            continue;
+        snprintf(path, sizeof(path), CACHE_SYSFS "/index%d/size", i);
+        if (sysfs_read(path, buf, sizeof(buf)) != 0 || parse_size(buf, &bytes) != 0)
+            continue;
+        snprintf(path, sizeof(path), CACHE_SYSFS "/index%d/coherency_line_size", i);
+        if (sysfs_read(path, buf, sizeof(buf)) != 0 || parse_size(buf, &coherency) != 0)
+            continue;
+        if (level > best_level) {
+            best_level = level;
+            *line = coherency;
+            *size = bytes;
+            // Not every cacheinfo provider fills this in
+            snprintf(path, sizeof(path), CACHE_SYSFS "/index%d/ways_of_associativity", i);
+            unsigned assoc;
+            best_ways = 0;
+            if (sysfs_read(path, buf, sizeof(buf)) == 0 && sscanf(buf, "%u", &assoc) == 1)
+                best_ways = assoc;
+        }
+    }
+    // An L1 on its own says nothing about the last level, its ways included
+    if (best_level > 1) {
+        if (best_ways)
+            *ways = best_ways;
+        return "detected via sysfs";
+    }
+
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE), l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    long l2_line = sysconf(_SC_LEVEL2_CACHE_LINESIZE), l3_line = sysconf(_SC_LEVEL3_CACHE_LINESIZE);
+    if (l3 > 0 && l3_line > 0) {
+        *line = l3_line;
+        *size = l3;
+        return "detected via sysconf";
+    }
+    if (l2 > 0 && l2_line > 0) {
+        *line = l2_line;
+        *size = l2;
+        return "detected via sysconf";
+    }
+#endif
+
+#ifdef __aarch64__
+    // CTR_EL0 is readable from EL0 under Linux, but only gives the line size.
+    // CCSIDR, which has the size, is only accessible from the kernel.
+    uint64_t ctr;
+    __asm__ volatile("mrs %0, ctr_el0" : "=r"(ctr));
+    *line = 4 << ((ctr >> 16) & 0xf);
+    return "line size detected via CTR_EL0";
+#endif
+    return NULL;
+}
+
+// Physical address of a resident page, or 0 if pagemap will not say
+static uint64_t virt_to_phys(int pagemap, const void* p) {
+    const long page = sysconf(_SC_PAGESIZE);
+    uint64_t entry;
+    if (pread(pagemap, &entry, sizeof(entry), (uintptr_t)p / page * sizeof(entry)) != sizeof(entry))
+        return 0;
+    return (entry & ((1ull << 55) - 1)) * page;
+}
+
+static unsigned num_colors(void) {
+    unsigned colors = l2_size / l2_ways / sysconf(_SC_PAGESIZE);
+    return colors ? colors : 1;
+}
+
+// Assemble a buffer from pages of the selected colours only, so that it maps
+// onto just that share of the L2 sets. Pages are found by faulting in pools
+// of anonymous memory and looking up their frames, and the keepers are moved
+// into place with mremap. The rest are given up to reclaim as they are
+// found, and unmapped together at the end.
+static uint8_t* alloc_colored(size_t size) {
+    const long page = sysconf(_SC_PAGESIZE);
+    const unsigned colors = num_colors();
+    uint8_t* pools[4 * MAX_COLORS];
+    unsigned num_pools = 0;
+    size_t filled = 0;
+    int err = ENOMEM;
+
+    uint8_t* buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (buf == MAP_FAILED)
+        return NULL;
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0) {
+        err = errno;
+        goto fail;
+    }
+    // Even a single colour should be filled within colors pools. Allow four
+    // times that for an allocator that hands out frames unevenly.
+    while (filled < size && num_pools < 4 * colors) {
+        uint8_t* pool = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pool == MAP_FAILED)
+            break;
+        pools[num_pools++] = pool;
+        // Split pages cannot be moved one at a time
+        madvise(pool, size, MADV_NOHUGEPAGE);
+        for (size_t off = 0; off < size && filled < size; off += page) {
+            pool[off] = 0;
+            uint64_t phys = virt_to_phys(fd, pool + off);
+            if (!phys) {
+                err = EPERM;
+                goto fail;
+            }
+            // Freed outright, a reject would be the next page faulted in
+            // again. Lazily freed, it stays out of the way until reclaim
+            // needs the memory back.
+            if (!(color_mask >> (phys / page % colors) & 1)) {
+                madvise(pool + off, page, MADV_FREE);
+                continue;
+            }
+            if (mremap(pool + off, page, page, MREMAP_MAYMOVE | MREMAP_FIXED, buf + filled) == MAP_FAILED) {
+                err = errno;
+                goto fail;
+            }
+            filled += page;
+        }
+    }
+fail:
+    // Pages moved out have left holes, which munmap() skips over
+    while (num_pools)
+        munmap(pools[--num_pools], size);
+    if (fd >= 0)
+        close(fd);
+    if (filled < size) {
+        munmap(buf, size);
+        errno = err;
+        return NULL;
+    }
+    return buf;
+}
+
+// Length actually mapped for a buffer of the given size. Whole pages keep
+// each following piece of a --phys or --udmabuf region at a valid offset.
+static size_t mapping_size(size_t size) {
+    size_t page = alloc_mode == ALLOC_HUGE ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+// Map a buffer as selected by alloc_mode. Sparse buffers only ever have a
+// fraction of their pages touched, so must not be committed up front.
+static uint8_t* alloc_buffer(size_t size, bool sparse) {
+    static bool warned;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | (sparse ? MAP_NORESERVE : 0);
+    void* buf;
+    size = mapping_size(size);
+    switch (alloc_mode) {
+    case ALLOC_PHYS:
+    case ALLOC_UDMABUF:
+        // Hand out consecutive, non-overlapping pieces of the region. A
+        // u-dma-buf device is mapped from its own start, not by address.
+        if (phys_used + size > phys_size) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, devmem_fd,
+                   (alloc_mode == ALLOC_PHYS ? phys_base : 0) + phys_used);
+        if (buf == MAP_FAILED)
+            return NULL;
+        phys_used += size;
+        return buf;
+    case ALLOC_HUGE:
+        if (!sparse) {
+            buf = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+            if (buf != MAP_FAILED)
+                return buf;
+            if (!warned)
+                perror("Unable to map hugetlbfs pages. Falling back to transparent huge pages");
+        }
+        buf = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (buf == MAP_FAILED)
+            return NULL;
+        if (madvise(buf, size, MADV_HUGEPAGE) != 0 && !warned)
+            perror("Unable to request transparent huge pages. Continuing with small pages");
+        warned = true;
+        return buf;
+    case ALLOC_COLORED:
+        if (!sparse)
+            return alloc_colored(size);
+        break;
+    case ALLOC_ANON:
+        break;
+    }
+    buf = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return buf == MAP_FAILED ? NULL : buf;
+}
+
+static void free_buffer(uint8_t* buf, size_t size) {
+    if (buf)
+        munmap(buf, mapping_size(size));
+}
+
+// Fault in every page of a buffer and print where it landed physically, as
+// found in /proc/self/pagemap. Reading frame numbers needs CAP_SYS_ADMIN.
+static void report_phys(const char* name, uint8_t* buf, size_t size) {
+    if (alloc_mode == ALLOC_PHYS || alloc_mode == ALLOC_UDMABUF) {
+        fprintf(info, "%s: physical 0x%" PRIx64 "-0x%" PRIx64 ", contiguous\n", name,
+                phys_base + phys_used - mapping_size(size), phys_base + phys_used - 1);
+        return;
+    }
+    const long page = sysconf(_SC_PAGESIZE);
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0) {
+        perror("Unable to open /proc/self/pagemap");
+        return;
+    }
+    uint64_t first = 0, prev = 0;
+    unsigned runs = 0;
+    for (size_t off = 0; off < size; off += page) {
+        *(volatile uint8_t*)(buf + off) = 0;
+        uint64_t phys = virt_to_phys(fd, buf + off);
+        if (!phys) {
+            fprintf(info, "%s: physical address unavailable\n", name);
+            close(fd);
+            return;
+        }
+        if (off == 0)
+            first = phys;
+        if (off == 0 || phys != prev + page)
+            runs++;
+        prev = phys;
+    }
+    close(fd);
+    fprintf(info, "%s: physical 0x%" PRIx64 " onwards, in %u contiguous run%s\n",
+            name, first, runs, runs == 1 ? "" : "s");
+}
+
+static int perf_open(uint32_t type, uint64_t config, pid_t pid, int cpu) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    // Uncore PMUs such as the PL310 cannot tell privilege levels apart
+    attr.exclude_kernel = pid != -1;
+    attr.exclude_hv = pid != -1;
+    return syscall(__NR_perf_event_open, &attr, pid, cpu, -1, 0);
+}
+
+static uint64_t perf_read(int fd) {
+    uint64_t count;
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+        return 0;
+    return count;
+}
+
+#ifndef THRASHER_LIBRARY
+// Read a single number out of a sysfs attribute such as "config=0x3"
+static int sysfs_scan(const char* path, const char* fmt, void* out) {
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return -1;
+    int ok = fscanf(f, fmt, out) == 1;
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+// Look up a u-dma-buf device's region and open it, with the cache mode set
+// through its sync_mode attribute. The driver only applies that mode to
+// mappings of a file opened O_SYNC.
+#define UDMABUF_SYSFS "/sys/class/u-dma-buf"
+static int udmabuf_open(const char* name) {
+    char path[128];
+    snprintf(path, sizeof(path), UDMABUF_SYSFS "/%s/size", name);
+    if (sysfs_scan(path, "%" SCNu64, &phys_size) != 0)
+        return -1;
+    snprintf(path, sizeof(path), UDMABUF_SYSFS "/%s/phys_addr", name);
+    if (sysfs_scan(path, "%" SCNx64, &phys_base) != 0)
+        return -1;
+    if (cache_mode != CACHE_DEFAULT) {
+        snprintf(path, sizeof(path), UDMABUF_SYSFS "/%s/sync_mode", name);
+        FILE* f = fopen(path, "w");
+        if (!f)
+            return -1;
+        // 1 is non-cached and 2 write-combined, when opened O_SYNC
+        bool ok = fprintf(f, "%d", cache_mode == CACHE_NC ? 1 : 2) > 0;
+        if (fclose(f) != 0 || !ok)
+            return -1;
+    }
+    snprintf(path, sizeof(path), "/dev/%s", name);
+    return open(path, O_RDWR | (cache_mode != CACHE_DEFAULT ? O_SYNC : 0));
+}
+
+// Memory operations the core issues per line visited. Once uncached, each is
+// a bus transaction of its own, bar any stores write-combining merges.
+static double ops_per_access(enum pattern pattern) {
+    switch (pattern) {
+    case PATTERN_WRITE:
+    case PATTERN_RANDOM_WRITE:
+        return (double)access_size() / sizeof(line_word_t);
+    case PATTERN_READ:
+    case PATTERN_RANDOM_READ:
+    case PATTERN_CHASE:
         return 1;
+    case PATTERN_BANK:
+        // Two rows are incremented per column and bank visited
+        return 2;
+    default:
+        return 2; // A load and a store
+    }
+}
+
+// Open one PL310 event system-wide, on the CPU the driver asks for
+static int l2c_open(const char* event) {
+    char path[128];
+    uint32_t type;
+    uint64_t config;
+    int cpu = 0;
+    snprintf(path, sizeof(path), L2C_PMU "/events/%s", event);
+    if (sysfs_scan(L2C_PMU "/type", "%" SCNu32, &type) != 0 ||
+        sysfs_scan(path, "config=%" SCNx64, &config) != 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    sysfs_scan(L2C_PMU "/cpumask", "%d", &cpu);
+    return perf_open(type, config, -1, cpu);
+}
+
+#endif
+
+// Wait until the next chunk is due. A worker that fell behind, e.g. by being
+// preempted, carries at most one chunk of debt rather than bursting to catch
+// up, as a burst is exactly the interference level we were asked to avoid.
+static void wait_until(bool sleep, uint64_t deadline) {
+    if (sleep) {
+        struct timespec ts = {
+            .tv_sec = deadline / 1000000000,
+            .tv_nsec = deadline % 1000000000,
+        };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+    } else {
+        while (now_ns() < deadline)
+            ;
+    }
+}
+
+static void pace(struct worker* w) {
+    uint64_t now = now_ns();
+    w->next_ns += w->chunk_ns;
+    if (w->next_ns + w->chunk_ns < now)
+        w->next_ns = now;
+    wait_until(w->sleep, w->next_ns);
+}
+
+// Every worker leaves this together, so that they start contending at the
+// same moment rather than as each happens to finish calibrating. Whoever
+// opens it records the time, which then anchors the --burst slots.
+struct spin_barrier {
+    uint32_t total; // Lowered by main if a worker could not be started
+    uint32_t arrived;
+    uint64_t open_ns; // 0 until everyone has arrived
+};
+static struct spin_barrier start_barrier;
+
+static void barrier_try_open(struct spin_barrier* b) {
+    uint64_t closed = 0;
+    if (__atomic_load_n(&b->arrived, __ATOMIC_ACQUIRE) >= __atomic_load_n(&b->total, __ATOMIC_ACQUIRE))
+        __atomic_compare_exchange_n(&b->open_ns, &closed, now_ns(), false,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+static uint64_t barrier_wait(struct spin_barrier* b) {
+    uint64_t open;
+    __atomic_add_fetch(&b->arrived, 1, __ATOMIC_ACQ_REL);
+    barrier_try_open(b);
+    // Yielding costs nothing on a core of our own, and lets workers sharing
+    // one reach the barrier at all, even under SCHED_FIFO
+    while ((open = __atomic_load_n(&b->open_ns, __ATOMIC_ACQUIRE)) == 0)
+        sched_yield();
+    return open;
+}
+
+// Bursts of burst_sweeps sweeps, started by every worker at each multiple of
+// burst_period_ns after the barrier opened. A burst that overruns its slot
+// skips to the next one, so the workers stay in phase.
+static uint32_t burst_sweeps;
+static uint64_t burst_period_ns;
+
+// Set once the workers should wrap up, by the signal thread below
+static bool stopping;
+
+// Slots can be seconds apart, so the wait is taken in slices of at most this
+// long, between which a stop is noticed
+#define BURST_SLICE_NS 10000000
+
+static void wait_for_burst(struct worker* w, uint64_t epoch) {
+    uint64_t now = now_ns();
+    uint64_t slot = epoch + ((now - epoch) / burst_period_ns + 1) * burst_period_ns;
+    while (now < slot && !__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+        wait_until(w->sleep, slot - now > BURST_SLICE_NS ? now + BURST_SLICE_NS : slot);
+        now = now_ns();
+    }
+}
+
+// The cheapest timestamp available. On ARM this is the cycle counter, which
+// userspace may only read once the kernel has set PMUSERENR, so it is probed
+// for with SIGILL caught; without it, clock_gettime() is far coarser but safe.
+static bool have_cycle_counter;
+#ifndef THRASHER_LIBRARY
+static sigjmp_buf probe_env;
+
+static void probe_failed(int sig) {
+    (void)sig;
+    siglongjmp(probe_env, 1);
+}
+#endif
+
+static inline uint64_t cycles(void) {
+#if defined(__arm__)
+    uint32_t c;
+    __asm__ volatile("mrc p15, 0, %0, c9, c13, 0" : "=r"(c));
+    return c;
+#elif defined(__aarch64__)
+    uint64_t c;
+    __asm__ volatile("mrs %0, pmccntr_el0" : "=r"(c));
+    return c;
+#elif defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static inline uint64_t timer_read(void) {
+    return have_cycle_counter ? cycles() : now_ns();
+}
+
+// Ticks since an earlier timer_read(). The A9's PMCCNTR is only 32 bits
+// wide and wraps every few seconds, so there the difference is taken modulo
+// 2^32 rather than turning a wrap into a huge sample.
+static inline uint64_t timer_since(uint64_t start) {
+#if defined(__arm__)
+    if (have_cycle_counter)
+        return (uint32_t)(cycles() - start);
+#endif
+    return timer_read() - start;
+}
+
+#ifndef THRASHER_LIBRARY
+static const char* timer_unit(void) {
+    return have_cycle_counter ? "cycles" : "ns";
+}
+#endif
+
+#ifndef THRASHER_LIBRARY
+// A counter that was never enabled reads as a constant, so check it moves
+static void probe_cycle_counter(void) {
+    struct sigaction probe = {.sa_handler = probe_failed}, saved;
+    sigaction(SIGILL, &probe, &saved);
+    if (sigsetjmp(probe_env, 1) == 0) {
+        uint64_t first = cycles(), start = now_ns();
+        while (now_ns() - start < 1000000)
+            ;
+        have_cycle_counter = cycles() != first;
+    }
+    sigaction(SIGILL, &saved, NULL);
+}
+#endif
+
+static unsigned hist_bucket(uint64_t v) {
+    if (v > UINT32_MAX)
+        v = UINT32_MAX;
+    if (v < HIST_SUB)
+        return v;
+    unsigned msb = 31 - __builtin_clz((uint32_t)v);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB + (v >> (msb - HIST_SUB_BITS) & (HIST_SUB - 1));
+}
+
+#ifndef THRASHER_LIBRARY
+// Largest value that lands in the bucket, so percentiles err high
+static uint64_t hist_value(unsigned bucket) {
+    if (bucket < HIST_SUB)
+        return bucket;
+    unsigned shift = bucket / HIST_SUB - 1;
+    return ((uint64_t)(HIST_SUB + bucket % HIST_SUB + 1) << shift) - 1;
+}
+
+// Smallest latency that at least the given fraction of samples did not exceed
+static uint64_t hist_percentile(const struct worker* w, double fraction) {
+    uint64_t rank = fraction * w->samples, seen = 0;
+    for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+        seen += w->hist[b];
+        if (seen > rank)
+            return hist_value(b) < w->sample_max ? hist_value(b) : w->sample_max;
+    }
+    return w->sample_max;
+}
+#endif
+
+// The fixed cost of a timed run, i.e. of the timer reads and the call, which
+// is then taken off every sample. The minimum is the least disturbed.
+static uint64_t measure_timer_overhead(struct worker* w) {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t start = timer_read();
+        w->sample_run(w, 0, 0);
+        uint64_t ticks = timer_since(start);
+        if (ticks < best)
+            best = ticks;
+    }
+    return best;
+}
+
+// Run one chunk as usual, except that the last access of every sample_lines
+// is issued and timed on its own. Keeping the timer out of the kernels means
+// the run without sampling is unchanged, at the cost of the rest of the
+// chunk using the generic variant too, as runs no longer line up with whole
+// unrolled iterations.
+static void sample_chunk(struct worker* w, uint32_t begin, uint32_t end) {
+    const uint32_t period = w->sample_lines * line_size;
+    for (uint32_t i = begin; i < end; i += period) {
+        uint32_t last = (i + period < end ? i + period : end) - line_size;
+        w->sample_run(w, i, last);
+        uint64_t start = timer_read();
+        w->sample_run(w, last, last + line_size);
+        uint64_t ticks = timer_since(start);
+        ticks = ticks > w->timer_overhead ? ticks - w->timer_overhead : 0;
+        w->hist[hist_bucket(ticks)]++;
+        w->samples++;
+        if (ticks > w->sample_max)
+            w->sample_max = ticks;
+    }
+}
+
+// Issue one full pass over the buffer, a chunk at a time. Returns the bytes
+// covered, which is less than a full pass only if stopped part way.
+static uint32_t sweep(struct worker* w, uint32_t iteration) {
+    run_fn run = w->sample_lines ? sample_chunk : w->run;
+    w->iteration = iteration;
+    for (uint32_t c = 0; c < buffer_size; c += CHUNK_SIZE) {
+        run(w, c, c + CHUNK_SIZE);
+        // Paced sweeps can take seconds, so they are stopped between chunks,
+        // as are those of programs embedding us that want the bus quiet now
+        if (w->chunk_ns)
+            pace(w);
+        if ((w->chunk_ns || w->prompt) && __atomic_load_n(&stopping, __ATOMIC_RELAXED))
+            return c + CHUNK_SIZE;
+    }
+    return buffer_size;
+}
+
+// Fault in every page of a buffer without changing what it holds
+static void prefault(uint8_t* buf, size_t size) {
+    const long page = sysconf(_SC_PAGESIZE);
+    for (size_t off = 0; off < size; off += page)
+        *(volatile uint8_t*)(buf + off) = *(volatile uint8_t*)(buf + off);
+}
+
+// Bytes/s of traffic generated by running the given kernel flat out, once warm
+static double measure_rate(struct worker* w, run_fn run) {
+    run_fn saved = w->run;
+    uint64_t chunk_ns = w->chunk_ns;
+    uint32_t sample_lines = w->sample_lines;
+    w->run = run;
+    w->chunk_ns = 0;
+    w->sample_lines = 0;
+    // Fault the buffer in first, so that only steady state is measured. A
+    // stop part way through cuts this short, leaving the warm-up sweep to go
+    // by if nothing else.
+    uint64_t elapsed = now_ns();
+    sweep(w, 0);
+    elapsed = now_ns() - elapsed;
+    uint32_t sweeps = 1;
+    uint64_t start = now_ns();
+    uint32_t i;
+    for (i = 0; i < CALIBRATION_SWEEPS && !__atomic_load_n(&stopping, __ATOMIC_RELAXED); i++)
+        sweep(w, i);
+    if (i) {
+        elapsed = now_ns() - start;
+        sweeps = i;
+    }
+    w->run = saved;
+    w->chunk_ns = chunk_ns;
+    w->sample_lines = sample_lines;
+    return traffic((double)buffer_size * sweeps) * 1e9 / (elapsed ? elapsed : 1);
+}
+
+static void* thrash(void* arg) {
+    struct worker* w = arg;
+
+    if (w->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        // A pid of 0 applies to the calling thread only
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+            perror("Unable to pin worker. Continuing unpinned");
+    }
+    if (w->fifo) {
+        struct sched_param param = {.sched_priority = w->fifo};
+        if (sched_setscheduler(0, SCHED_FIFO, &param) != 0)
+            perror("Unable to switch worker to SCHED_FIFO. Continuing unchanged");
+    }
+
+    // Take every page fault now, rather than as a storm in the first sweep.
+    // Only the bank pattern's rows are faulted in, not the whole span.
+    if (w->pattern == PATTERN_BANK)
+        w->run(w, 0, buffer_size);
+    else
+        prefault(w->buffer, buffer_size);
+
+    if (w->baseline)
+        w->baseline_rate = measure_rate(w, select_run(&kernels[PATTERN_RMW]));
+    // Rates count traffic, as the reports do, not bytes swept
+    if (w->rate)
+        w->chunk_ns = traffic(CHUNK_SIZE) * 1e9 / w->rate;
+    else if (w->duty)
+        w->chunk_ns = traffic(CHUNK_SIZE) * 1e9 / (w->duty * measure_rate(w, w->run));
+
+    if (w->sample_lines)
+        w->timer_overhead = measure_timer_overhead(w);
+
+    for (int e = 0; e < NUM_CORE_EVENTS; e++) {
+        w->pmu_fd[e] = -1;
+        if (w->pmu)
+            w->pmu_fd[e] = perf_open(core_events[e].type, core_events[e].config, 0, -1);
+    }
+
+    uint64_t epoch = barrier_wait(&start_barrier);
+    // Counting starts with the timed sweeps, not with the spin at the barrier.
+    // The system-wide PL310 counters wait until every worker is past set-up.
+    for (int e = 0; e < NUM_CORE_EVENTS; e++)
+        if (w->pmu_fd[e] >= 0)
+            ioctl(w->pmu_fd[e], PERF_EVENT_IOC_ENABLE, 0);
+    if (w->l2c_fd)
+        for (int e = 0; e < 2; e++)
+            if (w->l2c_fd[e] >= 0)
+                ioctl(w->l2c_fd[e], PERF_EVENT_IOC_ENABLE, 0);
+    uint64_t start = now_ns();
+    uint64_t last = start;
+    w->next_ns = start;
+    w->sweep_min_ns = UINT64_MAX;
+    for (uint32_t i = 0; i < w->iterations || w->infinite; i++) {
+        // The wait between bursts is not part of any sweep's time
+        if (burst_sweeps && i && i % burst_sweeps == 0) {
+            wait_for_burst(w, epoch);
+            uint64_t now = now_ns();
+            w->idle_ns += now - last;
+            last = now;
+            w->next_ns = last;
+            if (__atomic_load_n(&stopping, __ATOMIC_RELAXED))
+                break;
+        }
+        uint32_t bytes = sweep(w, i);
+        // One clock read per sweep of tens of thousands of lines is noise
+        uint64_t now = now_ns();
+        // Keep what a sweep cut short did move, but not as a sweep
+        if (bytes < buffer_size) {
+            w->partial_bytes = bytes;
+            w->partial_ns = now - last;
+            break;
+        }
+        if (now - last < w->sweep_min_ns)
+            w->sweep_min_ns = now - last;
+        if (now - last > w->sweep_max_ns)
+            w->sweep_max_ns = now - last;
+        last = now;
+        __atomic_store_n(&w->sweeps, w->sweeps + 1, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&stopping, __ATOMIC_RELAXED))
+            break;
+    }
+    w->elapsed_ns = last - start;
+
+    for (int e = 0; e < NUM_CORE_EVENTS; e++)
+        if (w->pmu_fd[e] >= 0)
+            ioctl(w->pmu_fd[e], PERF_EVENT_IOC_DISABLE, 0);
+    for (int e = 0; e < NUM_CORE_EVENTS; e++) {
+        w->pmu_count[e] = perf_read(w->pmu_fd[e]);
+        if (w->pmu_fd[e] >= 0)
+            close(w->pmu_fd[e]);
+    }
+    return NULL;
+}
+
+// Everything a worker moved, including any sweep cut short
+static double worker_bytes(const struct worker* w) {
+    return traffic((double)w->sweeps * buffer_size + w->partial_bytes);
+}
+
+static double mb_per_s(double bytes, uint64_t ns) {
+    return ns ? bytes * 1e3 / ns : 0;
+}
+
+#ifndef THRASHER_LIBRARY
+// Print the throughput achieved by moving the given bytes in ns
+static void report_rate(const char* name, double bytes, uint64_t ns) {
+    double lines = bytes / access_size();
+    double secs = ns / 1e9;
+    if (ns == 0 || bytes == 0)
+        return;
+    fprintf(info, "%s: %.1fMB/s, %.3gM lines/s, %.2fns per access over %.3fs\n",
+            name, bytes / 1e6 / secs, lines / 1e6 / secs, ns / lines, secs);
+}
+
+// Machine-readable results, written instead of the prose above
+enum output_format {
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_CSV,
+};
+
+static const char* const alloc_names[] = {
+    [ALLOC_ANON] = "anon",
+    [ALLOC_HUGE] = "huge",
+    [ALLOC_PHYS] = "phys",
+    [ALLOC_COLORED] = "colored",
+    [ALLOC_UDMABUF] = "udmabuf",
+};
+
+// Everything about a finished run that the per-worker state does not hold
+struct run_record {
+    const char* pattern; // "mixed" if the workers' patterns differ
+    struct worker* workers;
+    long threads;
+    bool pinned;
+    uint64_t wall_ns;
+    double total_bytes;
+    bool pmu;
+    const char* l2c_names[2]; // NULL where the event was unavailable
+    uint64_t l2c_count[2];
+};
+
+// One JSON object per run, on a single line so that runs can be appended
+static void write_json(FILE* f, const struct run_record* r) {
+    fprintf(f, "{\"pattern\":\"%s\",\"threads\":%ld,\"pinned\":%s,\"line_size\":%u,\"l2_size\":%u,"
+            "\"buffer_size\":%u,\"alloc\":\"%s\",\"bytes\":%.0f,\"duration_s\":%.6f,\"mb_s\":%.1f,\"workers\":[",
+            r->pattern, r->threads, r->pinned ? "true" : "false", line_size, l2_size, buffer_size,
+            alloc_names[alloc_mode], r->total_bytes, r->wall_ns / 1e9, mb_per_s(r->total_bytes, r->wall_ns));
+    for (long t = 0; t < r->threads; t++) {
+        const struct worker* w = &r->workers[t];
+        uint64_t ns = w->elapsed_ns + w->partial_ns;
+        fprintf(f, "%s{\"worker\":%ld,\"pattern\":\"%s\",\"cpu\":", t ? "," : "", t,
+                kernels[w->pattern].name);
+        if (w->cpu >= 0)
+            fprintf(f, "%d", w->cpu);
+        else
+            fprintf(f, "null");
+        fprintf(f, ",\"sweeps\":%" PRIu64 ",\"bytes\":%.0f,\"duration_s\":%.6f,\"mb_s\":%.1f",
+                w->sweeps, worker_bytes(w), ns / 1e9, mb_per_s(worker_bytes(w), ns));
+        if (w->sweeps)
+            fprintf(f, ",\"sweep_min_ms\":%.3f,\"sweep_max_ms\":%.3f",
+                    w->sweep_min_ns / 1e6, w->sweep_max_ns / 1e6);
+        if (w->baseline)
+            fprintf(f, ",\"baseline_mb_s\":%.1f", w->baseline_rate / 1e6);
+        if (w->samples)
+            fprintf(f, ",\"latency\":{\"unit\":\"%s\",\"samples\":%" PRIu64 ",\"p50\":%" PRIu64
+                    ",\"p99\":%" PRIu64 ",\"p999\":%" PRIu64 ",\"max\":%" PRIu64 "}",
+                    timer_unit(), w->samples, hist_percentile(w, 0.5), hist_percentile(w, 0.99),
+                    hist_percentile(w, 0.999), w->sample_max);
+        if (r->pmu) {
+            fprintf(f, ",\"pmu\":{");
+            for (int e = 0; e < NUM_CORE_EVENTS; e++) {
+                fprintf(f, "%s\"%s\":", e ? "," : "", core_events[e].key);
+                if (w->pmu_fd[e] >= 0)
+                    fprintf(f, "%" PRIu64, w->pmu_count[e]);
+                else
+                    fprintf(f, "null");
+            }
+            fprintf(f, "}");
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "]");
+    if (r->l2c_names[0] && r->l2c_names[1])
+        fprintf(f, ",\"pl310\":{\"%s\":%" PRIu64 ",\"%s\":%" PRIu64 "}",
+                r->l2c_names[0], r->l2c_count[0], r->l2c_names[1], r->l2c_count[1]);
+    fprintf(f, "}\n");
+}
+
+// One row per worker and one for the total, each repeating the run's set-up.
+// Fields that do not apply to a row, or were not measured, are left empty.
+static void write_csv(FILE* f, const struct run_record* r) {
+    fprintf(f, "pattern,threads,pinned,line_size,l2_size,buffer_size,alloc,worker,cpu,sweeps,bytes,"
+            "duration_s,mb_s,baseline_mb_s,latency_unit,latency_p50,latency_p99,latency_p999,latency_max");
+    for (int e = 0; e < NUM_CORE_EVENTS; e++)
+        fprintf(f, ",%s", core_events[e].key);
+    fprintf(f, ",l2c_requests,l2c_hits\n");
+    for (long t = 0; t <= r->threads; t++) {
+        fprintf(f, "%s,%ld,%d,%u,%u,%u,%s,", t < r->threads ? kernels[r->workers[t].pattern].name : r->pattern,
+                r->threads, r->pinned,
+                line_size, l2_size, buffer_size, alloc_names[alloc_mode]);
+        if (t == r->threads) {
+            fprintf(f, "total,,,%.0f,%.6f,%.1f,,,,,,", r->total_bytes, r->wall_ns / 1e9,
+                    mb_per_s(r->total_bytes, r->wall_ns));
+            for (int e = 0; e < NUM_CORE_EVENTS; e++)
+                fprintf(f, ",");
+            if (r->l2c_names[0] && r->l2c_names[1])
+                fprintf(f, ",%" PRIu64 ",%" PRIu64 "\n", r->l2c_count[0], r->l2c_count[1]);
+            else
+                fprintf(f, ",,\n");
+            break;
+        }
+        const struct worker* w = &r->workers[t];
+        uint64_t ns = w->elapsed_ns + w->partial_ns;
+        fprintf(f, "%ld,", t);
+        if (w->cpu >= 0)
+            fprintf(f, "%d", w->cpu);
+        fprintf(f, ",%" PRIu64 ",%.0f,%.6f,%.1f,", w->sweeps, worker_bytes(w), ns / 1e9,
+                mb_per_s(worker_bytes(w), ns));
+        if (w->baseline)
+            fprintf(f, "%.1f", w->baseline_rate / 1e6);
+        if (w->samples)
+            fprintf(f, ",%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64, timer_unit(),
+                    hist_percentile(w, 0.5), hist_percentile(w, 0.99), hist_percentile(w, 0.999),
+                    w->sample_max);
+        else
+            fprintf(f, ",,,,,");
+        for (int e = 0; e < NUM_CORE_EVENTS; e++) {
+            fprintf(f, ",");
+            if (r->pmu && w->pmu_fd[e] >= 0)
+                fprintf(f, "%" PRIu64, w->pmu_count[e]);
+        }
+        fprintf(f, ",,\n");
+    }
+}
+
+// Periodic sampling of the workers' progress. This runs on its own thread so
+// that the workers never do more than bump a counter once per sweep.
+struct reporter {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool done;
+    struct worker* workers;
+    long threads;
+    uint64_t interval_ns;
+    FILE* out; // NULL to print human-readable samples to stdout
+    enum output_format format; // Of the samples written to out
+};
+
+static void* report_live(void* arg) {
+    struct reporter* r = arg;
+    uint64_t* prev = calloc(r->threads, sizeof(uint64_t));
+    double* rate = calloc(r->threads, sizeof(double));
+    if (!prev || !rate) {
+        perror("Unable to allocate reporter state. Live reporting disabled");
+        free(prev);
+        free(rate);
+        return NULL;
+    }
+
+    if (r->out && r->format == FORMAT_CSV) {
+        fprintf(r->out, "time_s,total_mb_s");
+        for (long t = 0; t < r->threads; t++)
+            fprintf(r->out, ",worker%ld_mb_s", t);
+        fprintf(r->out, "\n");
+    }
+
+    uint64_t start = now_ns(), last = start;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    pthread_mutex_lock(&r->lock);
+    while (!r->done) {
+        // Sleep to an absolute deadline so that samples do not drift
+        uint64_t ns = deadline.tv_nsec + r->interval_ns;
+        deadline.tv_sec += ns / 1000000000;
+        deadline.tv_nsec = ns % 1000000000;
+        while (!r->done && pthread_cond_timedwait(&r->wake, &r->lock, &deadline) == 0)
+            ;
+        if (r->done)
+            break;
+
+        uint64_t now = now_ns();
+        double secs = (now - last) / 1e9;
+        double total = 0;
+        for (long t = 0; t < r->threads; t++) {
+            uint64_t sweeps = __atomic_load_n(&r->workers[t].sweeps, __ATOMIC_RELAXED);
+            rate[t] = traffic((double)(sweeps - prev[t]) * buffer_size) / 1e6 / secs;
+            total += rate[t];
+            prev[t] = sweeps;
+        }
+        last = now;
+
+        if (r->out && r->format == FORMAT_CSV) {
+            fprintf(r->out, "%.3f,%.1f", (now - start) / 1e9, total);
+            for (long t = 0; t < r->threads; t++)
+                fprintf(r->out, ",%.1f", rate[t]);
+            fprintf(r->out, "\n");
+            fflush(r->out);
+        } else if (r->out) {
+            fprintf(r->out, "{\"time_s\":%.3f,\"mb_s\":%.1f,\"workers_mb_s\":[", (now - start) / 1e9, total);
+            for (long t = 0; t < r->threads; t++)
+                fprintf(r->out, "%s%.1f", t ? "," : "", rate[t]);
+            fprintf(r->out, "]}\n");
+            fflush(r->out);
+        } else {
+            fprintf(stdout, "[%.3fs] %.1fMB/s", (now - start) / 1e9, total);
+            if (r->threads > 1) {
+                for (long t = 0; t < r->threads; t++)
+                    fprintf(stdout, "%s%.1f", t ? ", " : " (", rate[t]);
+                fprintf(stdout, ")");
+            }
+            fprintf(stdout, "\n");
+            fflush(stdout);
+        }
+    }
+    pthread_mutex_unlock(&r->lock);
+    free(prev);
+    free(rate);
+    return NULL;
+}
+
+// SIGINT and SIGTERM stop the workers at the end of their current sweep, and
+// SIGUSR1 prints progress so far. All three are blocked everywhere but here,
+// where they are taken synchronously, so the workers only ever poll a flag.
+// The same flag is raised once any --duration is up.
+struct signaller {
+    pthread_t thread;
+    sigset_t set;
+    struct worker* workers;
+    long threads;
+    uint64_t duration_ns; // 0 to run until stopped
+};
+
+static void* handle_signals(void* arg) {
+    struct signaller* s = arg;
+    uint64_t* prev = calloc(s->threads, sizeof(uint64_t));
+    uint64_t last = now_ns(), deadline = 0;
+    for (;;) {
+        int sig;
+        if (s->duration_ns) {
+            // --duration counts from when the workers leave the barrier, not
+            // from their set-up, so until then wait in short slices for it
+            uint64_t open = __atomic_load_n(&start_barrier.open_ns, __ATOMIC_ACQUIRE);
+            if (open && !deadline)
+                deadline = open + s->duration_ns;
+            uint64_t now = now_ns(), wait = 10000000;
+            if (deadline)
+                wait = now < deadline ? deadline - now : 0;
+            struct timespec left = {
+                .tv_sec = wait / 1000000000,
+                .tv_nsec = wait % 1000000000,
+            };
+            sig = sigtimedwait(&s->set, NULL, &left);
+            if (sig < 0 && errno == EAGAIN) {
+                if (!deadline)
+                    continue;
+                sig = SIGALRM;
+            }
+        } else if (sigwait(&s->set, &sig) != 0) {
+            continue;
+        }
+        if (sig < 0)
+            continue;
+        if (sig != SIGUSR1) {
+            __atomic_store_n(&stopping, true, __ATOMIC_RELAXED);
+            break;
+        }
+        // Rates are since the last SIGUSR1, or since the workers started
+        uint64_t now = now_ns(), total = 0;
+        for (long t = 0; t < s->threads; t++) {
+            uint64_t sweeps = __atomic_load_n(&s->workers[t].sweeps, __ATOMIC_RELAXED);
+            char name[32];
+            snprintf(name, sizeof(name), "Worker %ld", t);
+            fprintf(info, "%s: %" PRIu64 " sweeps so far\n", name, sweeps);
+            if (prev) {
+                report_rate(name, traffic((double)(sweeps - prev[t]) * buffer_size), now - last);
+                prev[t] = sweeps;
+            }
+            total += sweeps;
+        }
+        fprintf(info, "Generated %.1fMiB of memory requests so far.\n",
+                traffic((double)total * buffer_size) / (1 << 20));
+        fflush(info);
+        last = now;
+    }
+    free(prev);
+    return NULL;
+}
+
+// The victim is a fixed pointer chase over half the L2, which runs from the
+// cache when alone and so shows every line a thrasher evicts. Each
+// measurement is the median of some runs, to shrug off the odd preemption.
+#define VICTIM_TRIPS 16
+#define VICTIM_RUNS 5
+#define VICTIM_SETTLE_MS 500
+#define MAX_THRASHERS 3 // Beside the victim
+
+static void* volatile victim_sink;
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Median ns one victim run takes, after a first trip to warm the cache
+static uint64_t time_victim(uint8_t* buffer, uint32_t lines, uint64_t* runs, long num_runs) {
+    void* p = buffer;
+    for (uint32_t i = 0; i < lines; i++)
+        p = *(void**)p;
+    for (long r = 0; r < num_runs; r++) {
+        uint64_t start = now_ns();
+        for (uint32_t i = 0; i < lines * VICTIM_TRIPS; i++)
+            p = *(void**)p;
+        runs[r] = now_ns() - start;
+    }
+    victim_sink = p;
+    qsort(runs, num_runs, sizeof(uint64_t), compare_u64);
+    return runs[num_runs / 2];
+}
+
+// Start a thrasher of the given pattern pinned to cpu, with the options this
+// process was given. It dies with us, and prints nothing.
+static pid_t spawn_thrasher(char** args, int cpu) {
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    execv("/proc/self/exe", args);
+    perror("Unable to start thrasher");
+    _exit(127);
+}
+
+struct victim {
+    uint8_t* buffer;
+    uint32_t size;
+    uint32_t lines;
+    uint64_t* runs;
+    long num_runs;
+    uint64_t alone; // Median ns with nothing else running
+};
+
+// Build the victim and time it alone, pinned to CPU 0, which it keeps
+static int victim_setup(struct victim* v, long num_runs) {
+    uint32_t seed = 1; // The victim is the same every time
+    v->size = l2_size / 2 / line_size * line_size;
+    v->lines = v->size / line_size;
+    v->num_runs = num_runs;
+    v->runs = calloc(num_runs, sizeof(uint64_t));
+    v->buffer = mmap(NULL, v->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!v->runs || v->buffer == MAP_FAILED || link_cycle(v->buffer, v->lines, &seed) != 0) {
+        free(v->runs);
+        if (v->buffer != MAP_FAILED)
+            munmap(v->buffer, v->size);
+        return -1;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        perror("Unable to pin the victim. Continuing unpinned");
+    v->alone = time_victim(v->buffer, v->lines, v->runs, num_runs);
+    return 0;
+}
+
+static void victim_free(struct victim* v) {
+    free(v->runs);
+    munmap(v->buffer, v->size);
+}
+
+// How much slower the victim runs next to n thrashers started with args on
+// CPUs 1 to n, or 0 if any of them exited before it could be timed
+static double victim_slowdown(struct victim* v, char** args, long n) {
+    pid_t pids[MAX_THRASHERS];
+    bool failed = false;
+    for (long c = 0; c < n; c++)
+        pids[c] = spawn_thrasher(args, c + 1);
+    // Give them time to allocate and calibrate before timing
+    struct timespec settle = {VICTIM_SETTLE_MS / 1000, VICTIM_SETTLE_MS % 1000 * 1000000};
+    nanosleep(&settle, NULL);
+    for (long c = 0; c < n; c++) {
+        if (pids[c] > 0 && waitpid(pids[c], NULL, WNOHANG) != 0)
+            pids[c] = -1;
+        failed |= pids[c] < 0;
+    }
+    uint64_t loaded = failed ? 0 : time_victim(v->buffer, v->lines, v->runs, v->num_runs);
+    for (long c = 0; c < n; c++) {
+        if (pids[c] > 0) {
+            kill(pids[c], SIGTERM);
+            waitpid(pids[c], NULL, 0);
+        }
+    }
+    return (double)loaded / v->alone;
+}
+
+// Time the victim on CPU 0 alone, then next to 1 to 3 thrashers of every
+// pattern on the other cores, and print how much slower it ran. args is the
+// command line for the thrashers, with room for "-p" and a pattern at the end.
+static int run_victim(char** args, int nargs, long cpus, long num_runs) {
+    const long max_thrashers = cpus - 1 < MAX_THRASHERS ? cpus - 1 : MAX_THRASHERS;
+    struct victim v;
+    if (max_thrashers < 1) {
+        fprintf(stderr, "The victim needs a core to itself and at least one more for a thrasher.\n");
+        return 1;
+    }
+    if (victim_setup(&v, num_runs) != 0) {
+        perror("Unable to set up the victim. Terminating...");
+        return 2;
+    }
+    fprintf(stdout, "Victim: %uKiB pointer chase on CPU 0, %.3fms alone\n", v.size / 1024, v.alone / 1e6);
+
+    fprintf(stdout, "%-14s", "Slowdown");
+    for (long n = 1; n <= max_thrashers; n++)
+        fprintf(stdout, " %d thrasher%s", (int)n, n > 1 ? "s" : " ");
+    fprintf(stdout, "\n");
+    args[nargs] = "-p";
+    args[nargs + 2] = NULL;
+    for (int p = 0; p < NUM_PATTERNS; p++) {
+        args[nargs + 1] = (char*)kernels[p].name;
+        fprintf(stdout, "%-14s", kernels[p].name);
+        fflush(stdout);
+        for (long n = 1; n <= max_thrashers; n++) {
+            double slowdown = victim_slowdown(&v, args, n);
+            if (slowdown == 0)
+                fprintf(stdout, " %11s", "failed");
+            else
+                fprintf(stdout, " %10.2fx", slowdown);
+            fflush(stdout);
+        }
+        fprintf(stdout, "\n");
+    }
+    victim_free(&v);
+    return 0;
+}
+
+// --calibrate tries every combination of these with every pattern, each for
+// a short run, and keeps whichever puts the most pressure on the bus
+static const uint32_t trial_strides[] = {32, 64, 128, 4096};
+static const char* const trial_multipliers[] = {"1", "2", "4", "8"};
+#define NUM_TRIAL_STRIDES (sizeof(trial_strides) / sizeof(trial_strides[0]))
+#define NUM_TRIAL_MULTIPLIERS (sizeof(trial_multipliers) / sizeof(trial_multipliers[0]))
+#define MAX_TRIAL_THREADS 8
+
+// MB/s that a run with args moved to or from DRAM, from its JSON record, or
+// 0 if it failed. Where the record has miss counts, from the PL310 or else
+// every worker's LL misses, those are the score and counted is set. Failing
+// that, the score is the workers' own line traffic, which leaves out their
+// set-up time but also counts lines that hit in the cache.
+static double run_trial(char** args, bool* counted) {
+    int out[2];
+    if (pipe(out) != 0)
+        return 0;
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(out[1], STDOUT_FILENO);
+        if (null >= 0)
+            dup2(null, STDERR_FILENO);
+        close(out[0]);
+        execv("/proc/self/exe", args);
+        _exit(127);
+    }
+    close(out[1]);
+    char record[4096];
+    size_t len = 0;
+    ssize_t n;
+    while (pid > 0 && (n = read(out[0], record + len, sizeof(record) - 1 - len)) > 0)
+        len += n;
+    close(out[0]);
+    record[len] = '\0';
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return 0;
+
+    // The run's own duration comes ahead of its workers'
+    const char* field = strstr(record, "\"duration_s\":");
+    double seconds = field ? strtod(field + strlen("\"duration_s\":"), NULL) : 0;
+    uint64_t requests, hits, misses = 0;
+    *counted = false;
+    if ((field = strstr(record, "\"pl310\":")) != NULL &&
+        sscanf(field, "\"pl310\":{\"%*[a-z]\":%" SCNu64 ",\"%*[a-z]\":%" SCNu64, &requests, &hits) == 2) {
+        misses = requests > hits ? requests - hits : 0;
+        *counted = true;
+    } else if ((field = strstr(record, "\"ll_misses\":")) != NULL) {
+        // Null wherever a worker could not open the counter
+        *counted = true;
+        for (; field; field = strstr(field, "\"ll_misses\":")) {
+            field += strlen("\"ll_misses\":");
+            misses += strtoull(field, NULL, 10);
+            *counted &= *field != 'n';
+        }
+    }
+    if (*counted)
+        return seconds > 0 ? misses * cache_line / seconds / 1e6 : 0;
+
+    double total = 0;
+    field = strstr(record, "\"workers\":");
+    while (field && (field = strstr(field, "\"mb_s\":")) != NULL) {
+        field += strlen("\"mb_s\":");
+        total += strtod(field, NULL);
+    }
+    return total;
+}
+
+// Write the options a later run can load with --config
+static int save_config(const char* path, const char* pattern, uint32_t stride,
+                       const char* multiplier, long threads, const char* score) {
+    FILE* f = fopen(path, "w");
+    if (!f)
+        return -1;
+    fprintf(f, "# Found by --calibrate: %s\n", score);
+    fprintf(f, "pattern = %s\nline-size = %u\nmultiplier = %s\nthreads = %ld\n",
+            pattern, stride, multiplier, threads);
+    return fclose(f);
+}
+
+// Run every trial and report the most destructive configuration. With
+// victim set, that is the one slowing the victim most from the other cores;
+// otherwise it is the one missing the cache most often, by the counters
+// --pmu opens. Without them, only line traffic is known, which lines that
+// hit count towards too, so trials whose lines can stay in the cache, the
+// prefetch pattern's and those at --multiplier 1, are left out of the
+// ranking. args is the command line for the trials, with room for the
+// trial's own options.
+static int run_calibration(char** args, int nargs, long cpus, bool victim,
+                           const char* trial_seconds, const char* save_path) {
+    const long max_threads = victim ? (cpus - 1 < MAX_THRASHERS ? cpus - 1 : MAX_THRASHERS)
+                                    : (cpus < MAX_TRIAL_THREADS ? cpus : MAX_TRIAL_THREADS);
+    struct victim v;
+    if (max_threads < 1) {
+        fprintf(stderr, "The victim needs a core to itself and at least one more for a thrasher.\n");
+        return 1;
+    }
+    if (victim && victim_setup(&v, VICTIM_RUNS) != 0) {
+        perror("Unable to set up the victim. Terminating...");
+        return 2;
+    }
+
+    char stride[16], threads[16], best_score[64] = "";
+    const char* best_pattern = NULL;
+    const char* best_multiplier = NULL;
+    uint32_t best_stride = 0;
+    long best_threads = 0;
+    double best = 0;
+    bool best_counted = false, unranked = false;
+    int a = nargs;
+    args[a++] = "-p";
+    const int pattern_arg = a++;
+    args[a++] = "--line-size";
+    args[a++] = stride;
+    args[a++] = "--multiplier";
+    const int multiplier_arg = a++;
+    if (!victim) {
+        // Victim thrashers run one each, until stopped
+        args[a++] = "--threads";
+        args[a++] = threads;
+        args[a++] = "--format";
+        args[a++] = "json";
+        args[a++] = "--duration";
+        args[a++] = (char*)trial_seconds;
+    }
+    args[a] = NULL;
+
+    for (int p = 0; p < NUM_PATTERNS; p++) {
+        args[pattern_arg] = (char*)kernels[p].name;
+        for (size_t s = 0; s < NUM_TRIAL_STRIDES; s++) {
+            snprintf(stride, sizeof(stride), "%u", trial_strides[s]);
+            for (size_t m = 0; m < NUM_TRIAL_MULTIPLIERS; m++) {
+                args[multiplier_arg] = (char*)trial_multipliers[m];
+                for (long t = 1; t <= max_threads; t++) {
+                    snprintf(threads, sizeof(threads), "%ld", t);
+                    bool counted = false;
+                    double score = victim ? victim_slowdown(&v, args, t) : run_trial(args, &counted);
+                    // Prefetches need not miss, nor does a buffer the size of the cache
+                    bool ranked = victim || counted ||
+                                  (p != PATTERN_PREFETCH && strcmp(trial_multipliers[m], "1") != 0);
+                    fprintf(info, "%-14s stride %-5u x%-2s %ld thread%s: ", kernels[p].name,
+                            trial_strides[s], trial_multipliers[m], t, t > 1 ? "s" : " ");
+                    if (score == 0)
+                        fprintf(info, "failed\n");
+                    else if (victim)
+                        fprintf(info, "%.2fx slowdown\n", score);
+                    else
+                        fprintf(info, "%.1fMB/s of %s%s\n", score, counted ? "misses" : "lines",
+                                ranked ? "" : ", not ranked");
+                    fflush(info);
+                    unranked |= score > 0 && !ranked;
+                    // Counted misses outrank line traffic, should only some trials have them
+                    if (ranked && score > 0 && (counted > best_counted || (counted == best_counted && score > best))) {
+                        best = score;
+                        best_counted = counted;
+                        best_pattern = kernels[p].name;
+                        best_stride = trial_strides[s];
+                        best_multiplier = trial_multipliers[m];
+                        best_threads = t;
+                    }
+                }
+            }
+        }
+    }
+    if (victim)
+        victim_free(&v);
+    if (!best_pattern) {
+        fprintf(stderr, "Every trial failed.\n");
+        return 2;
+    }
+
+    if (unranked)
+        fprintf(info, "Prefetch and --multiplier 1 trials were not ranked, as without --pmu\n"
+                "there is no telling how many of their lines missed the cache.\n");
+    if (victim)
+        snprintf(best_score, sizeof(best_score), "%.2fx victim slowdown", best);
+    else
+        snprintf(best_score, sizeof(best_score), "%.1fMB/s of %s", best, best_counted ? "misses" : "lines");
+    fprintf(stdout, "Most destructive: --pattern %s --line-size %u --multiplier %s --threads %ld (%s)\n",
+            best_pattern, best_stride, best_multiplier, best_threads, best_score);
+    if (save_path && save_config(save_path, best_pattern, best_stride, best_multiplier,
+                                 best_threads, best_score) != 0) {
+        perror("Unable to save configuration");
+        return 2;
+    }
+    return 0;
+}
+
+// Whether the command line gives the named long option, or its short form
+static bool command_line_gives(int argc, char** argv, const char* name) {
+    const size_t len = strlen(name);
+    const char short_name = strcmp(name, "threads") == 0 ? 't' : strcmp(name, "pattern") == 0 ? 'p' : '\0';
+    for (int i = 1; i < argc && strcmp(argv[i], "--") != 0; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--", 2) == 0 && strncmp(arg + 2, name, len) == 0 &&
+            (arg[2 + len] == '\0' || arg[2 + len] == '='))
+            return true;
+        if (short_name && arg[0] == '-' && arg[1] == short_name)
+            return true;
+    }
+    return false;
+}
+
+// Options that stand in for each other, of which the command line's choice
+// replaces the config file's, e.g. --size for a saved --multiplier
+static const char* const config_rivals[][2] = {
+    {"multiplier", "size"},
+    {"size", "multiplier"},
+    {"threads", "worker"},
+    {"worker", "threads"},
+};
+
+// Splice the options in a --config file in ahead of the command line's own,
+// as defaults for it. Any the command line gives itself or replaces with a
+// rival are left out, so that neither repeats nor conflicts. Each line is
+// "option = value" or "option", for a long option without its dashes, and #
+// starts a comment.
+static int load_config(int* argc, char*** argv) {
+    const char* path = NULL;
+    for (int i = 1; i < *argc && !path; i++) {
+        if (strcmp((*argv)[i], "--") == 0)
+            break;
+        if (strcmp((*argv)[i], "--config") == 0 && i + 1 < *argc)
+            path = (*argv)[i + 1];
+        else if (strncmp((*argv)[i], "--config=", strlen("--config=")) == 0)
+            path = (*argv)[i] + strlen("--config=");
+    }
+    if (!path)
+        return 0;
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return -1;
+    // The strings live for as long as the program
+    int count = 1, capacity = *argc + 16;
+    char** args = malloc(capacity * sizeof(char*));
+    char line[256];
+    args[0] = (*argv)[0];
+    while (args && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "#\n")] = '\0';
+        char* name = strtok(line, " \t=");
+        char* value = strtok(NULL, " \t=");
+        if (!name)
+            continue;
+        bool replaced = command_line_gives(*argc, *argv, name);
+        for (size_t r = 0; r < sizeof(config_rivals) / sizeof(config_rivals[0]); r++)
+            replaced |= strcmp(name, config_rivals[r][0]) == 0 &&
+                        command_line_gives(*argc, *argv, config_rivals[r][1]);
+        if (replaced)
+            continue;
+        if (count + 2 + *argc >= capacity) {
+            capacity *= 2;
+            char** grown = realloc(args, capacity * sizeof(char*));
+            if (!grown) {
+                free(args);
+                args = NULL;
+                break;
+            }
+            args = grown;
+        }
+        char* option = malloc(strlen(name) + 3);
+        if (!option)
+            break;
+        sprintf(option, "--%s", name);
+        args[count++] = option;
+        if (value)
+            args[count++] = strdup(value);
+    }
+    fclose(f);
+    if (!args) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (int i = 1; i < *argc; i++)
+        args[count++] = (*argv)[i];
+    args[count] = NULL;
+    *argc = count;
+    *argv = args;
+    return 0;
+}
+
+#endif
+
+// Settle on the cache geometry, from sysfs or the built-in defaults unless
+// overridden, and size the buffers to match. Returns 0, or -1 if the buffers
+// would be too large.
+static int set_geometry(uint64_t line_override, uint64_t l2_override, double multiplier, uint64_t size) {
+    uint32_t detected_line = LINE_SIZE, detected_size = L2_SIZE, detected_ways = L2_WAYS;
+    const char* source = detect_geometry(&detected_line, &detected_size, &detected_ways);
+    // A line smaller than a NEON store or a pointer would break the kernels
+    if (!source || detected_line < 16 || detected_line & (detected_line - 1)) {
+        detected_line = LINE_SIZE;
+        detected_ways = L2_WAYS;
+        source = NULL;
+    }
+    l2_ways = detected_ways;
+    line_size = line_override ? line_override : detected_line;
+    cache_line = detected_line;
+    l2_size = l2_override ? l2_override : source ? detected_size : L2_SIZE;
+    if (line_override || l2_override)
+        source = "overridden";
+    fprintf(info, "Using %u-byte lines and a %uKiB last-level cache (%s).\n",
+            line_size, l2_size / 1024, source ? source : "built-in default");
+    // Anything else would split every access over two lines, and misalign
+    // the word loads that fault on uncached mappings
+    if (buffer_offset % line_size) {
+        fprintf(stderr, "The offset must be a multiple of the %u-byte line size.\n", line_size);
+        return -1;
+    }
+    // By default, make the buffer meaningfully larger than the L2 such that
+    // when iterating through, subsequent access to the same address will miss.
+    // We make it generously larger as the L2 does not use true LRU.
+    double bytes = size ? size : l2_size * (multiplier ? multiplier : 4);
+    if (bytes > UINT32_MAX - CHUNK_SIZE) {
+        fprintf(stderr, "Buffers of %.0f bytes are too large.\n", bytes);
+        return -1;
+    }
+    buffer_size = ((uint32_t)bytes + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+    // Each mapping holds the offset and the buffer, in a 32-bit size_t on ARM
+    if ((uint64_t)buffer_size + buffer_offset > UINT32_MAX) {
+        fprintf(stderr, "Buffers of %u bytes at an offset of %u are too large.\n", buffer_size, buffer_offset);
+        return -1;
+    }
+    return 0;
+}
+
+// Map a worker's own buffer and report where it landed
+static int alloc_worker(struct worker* w, long t) {
+    w->base = alloc_buffer((size_t)buffer_size + buffer_offset, false);
+    if (!w->base)
+        return -1;
+    w->buffer = w->base + buffer_offset;
+    if (alloc_mode != ALLOC_ANON) {
+        char name[32];
+        snprintf(name, sizeof(name), "Worker %ld buffer", t);
+        report_phys(name, w->buffer, buffer_size);
+    }
+    return 0;
+}
+
+// Start a thread per worker. Should one fail, those already waiting at the
+// barrier are let go only to stop straight away, and errno is set. Returns
+// how many were started, all of which must be joined.
+static long start_workers(struct worker* workers, long threads) {
+    long started;
+    for (started = 0; started < threads; started++) {
+        int err = pthread_create(&workers[started].thread, NULL, thrash, &workers[started]);
+        if (err) {
+            fprintf(stderr, "Unable to start worker %ld: %s\n", started, strerror(err));
+            __atomic_store_n(&stopping, true, __ATOMIC_RELAXED);
+            __atomic_store_n(&start_barrier.total, started, __ATOMIC_RELEASE);
+            barrier_try_open(&start_barrier);
+            errno = err;
+            break;
+        }
+    }
+    return started;
+}
+
+// Undo each set-up kernel's init() and unmap every worker's own buffer
+static void free_workers(struct worker* workers, long threads, long initialized) {
+    for (long t = 0; t < initialized; t++)
+        if (kernels[workers[t].pattern].teardown)
+            kernels[workers[t].pattern].teardown(&workers[t]);
+    for (long t = 0; t < threads; t++) {
+        free_buffer(workers[t].base, (size_t)buffer_size + buffer_offset);
+        workers[t].base = NULL;
+    }
+}
+
+#ifdef THRASHER_LIBRARY
+// The run thrasher_start() began, kept after it stops for thrasher_stats()
+static struct {
+    struct worker* workers;
+    long threads;
+    bool running;
+    uint64_t start_ns; // When the workers left the barrier
+    uint64_t stop_ns; // When the last of them had stopped
+} embedded;
+
+int thrasher_start(const struct thrasher_config* config) {
+    if (embedded.running) {
+        errno = EBUSY;
+        return -1;
+    }
+    enum pattern pattern = config->pattern ? find_pattern(config->pattern) : PATTERN_RMW;
+    uint32_t line = config->line_size;
+    // The bank pattern's shared span and row split are left to the command line
+    if (pattern == NUM_PATTERNS || pattern == PATTERN_BANK || config->threads < 0 || config->multiplier < 0 ||
+        config->rate < 0 || config->duty < 0 || config->duty > 100 || (config->rate && config->duty) ||
+        (line && (line < 16 || line > CHUNK_SIZE || line & (line - 1))) || config->l2_size > UINT32_MAX / 4) {
+        errno = EINVAL;
+        return -1;
+    }
+    // Progress messages go to stderr, leaving the host's stdout alone
+    if (!info)
+        info = stderr;
+    if (set_geometry(line, config->l2_size, config->multiplier, config->size) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+#ifdef __arm__
+    // As on the command line, clean needs a buffer the PL310 has to evict from
+    if (pattern == PATTERN_CLEAN && buffer_size <= l2_size) {
+        errno = EINVAL;
+        return -1;
+    }
+#endif
+
+    free(embedded.workers);
+    embedded.workers = NULL;
+    long threads = config->threads ? config->threads : 1;
+    struct worker* workers = calloc(threads, sizeof(struct worker));
+    if (!workers)
+        return -1;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+    const struct kernel* kernel = &kernels[pattern];
+    long initialized = 0, started = 0;
+    int err = 0;
+    for (long t = 0; t < threads; t++) {
+        struct worker* w = &workers[t];
+        w->cpu = config->threads ? t % cpus : -1;
+        w->pattern = pattern;
+        w->run = select_run(kernel);
+        w->sample_run = kernel->run;
+        w->prefetch_lines = PREFETCH_LINES;
+        w->infinite = true;
+        w->prompt = true;
+        w->rate = config->rate * 1e6 / threads;
+        w->duty = config->duty / 100;
+        w->seed = (now_ns() ^ t) | 1;
+        if (alloc_worker(w, t) != 0 || (kernel->init && kernel->init(w) != 0)) {
+            err = errno;
+            goto fail;
+        }
+        initialized++;
+    }
+
+    // The caller waits at the barrier too, so that it only returns once
+    // every worker is sweeping
+    __atomic_store_n(&stopping, false, __ATOMIC_RELAXED);
+    start_barrier = (struct spin_barrier){.total = threads + 1};
+    started = start_workers(workers, threads);
+    if (started < threads) {
+        err = errno;
+        goto fail;
+    }
+    embedded.start_ns = barrier_wait(&start_barrier);
+    embedded.workers = workers;
+    embedded.threads = threads;
+    embedded.running = true;
+    return 0;
+
+fail:
+    for (long t = 0; t < started; t++)
+        pthread_join(workers[t].thread, NULL);
+    free_workers(workers, threads, initialized);
+    free(workers);
+    errno = err;
+    return -1;
+}
+
+int thrasher_stop(void) {
+    if (!embedded.running) {
+        errno = ESRCH;
+        return -1;
+    }
+    __atomic_store_n(&stopping, true, __ATOMIC_RELAXED);
+    for (long t = 0; t < embedded.threads; t++)
+        pthread_join(embedded.workers[t].thread, NULL);
+    embedded.stop_ns = now_ns();
+    embedded.running = false;
+    free_workers(embedded.workers, embedded.threads, embedded.threads);
+    return 0;
+}
+
+// Workers only publish whole sweeps while running. What a stop cut short is
+// added in once they have all finished.
+int thrasher_stats(struct thrasher_stats* stats) {
+    if (!embedded.workers) {
+        errno = ESRCH;
+        return -1;
+    }
+    bool running = embedded.running;
+    *stats = (struct thrasher_stats){
+        .ns = (running ? now_ns() : embedded.stop_ns) - embedded.start_ns,
+    };
+    for (long t = 0; t < embedded.threads; t++) {
+        const struct worker* w = &embedded.workers[t];
+        uint64_t sweeps = __atomic_load_n(&w->sweeps, __ATOMIC_RELAXED);
+        stats->sweeps += sweeps;
+        stats->bytes += running ? traffic((double)sweeps * buffer_size) : worker_bytes(w);
+    }
+    stats->mb_s = mb_per_s(stats->bytes, stats->ns);
+    return 0;
+}
+#else
+int main(int argc, char** argv) {
+    static const struct option long_opts[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"pattern", required_argument, NULL, 'p'},
+        {"worker", required_argument, NULL, 'w'},
+        {"bank-mask", required_argument, NULL, 'B'},
+        {"bank-shift", required_argument, NULL, 'S'},
+        {"row-shift", required_argument, NULL, 'R'},
+        {"report-interval", required_argument, NULL, 'I'},
+        {"report-file", required_argument, NULL, 'F'},
+        {"rate", required_argument, NULL, 'r'},
+        {"duty", required_argument, NULL, 'd'},
+        {"pace", required_argument, NULL, 'W'},
+        {"duration", required_argument, NULL, 'T'},
+        {"burst", required_argument, NULL, 'Y'},
+        {"fifo", required_argument, NULL, 'Q'},
+        {"mlock", no_argument, NULL, 'U'},
+        {"line-size", required_argument, NULL, 'L'},
+        {"l2-size", required_argument, NULL, 'C'},
+        {"multiplier", required_argument, NULL, 'X'},
+        {"size", required_argument, NULL, 'Z'},
+        {"offset", required_argument, NULL, 'O'},
+        {"colors", required_argument, NULL, 'K'},
+        {"hugepages", no_argument, NULL, 'H'},
+        {"phys", required_argument, NULL, 'M'},
+        {"udmabuf", required_argument, NULL, 'G'},
+        {"uncached", required_argument, NULL, 'E'},
+        {"prefetch-distance", required_argument, NULL, 'D'},
+        {"baseline", no_argument, NULL, 'A'},
+        {"pmu", no_argument, NULL, 'P'},
+        {"sample", required_argument, NULL, 'N'},
+        {"victim", no_argument, NULL, 'V'},
+        {"calibrate", no_argument, NULL, 'c'},
+        {"save-config", required_argument, NULL, 'o'},
+        {"config", required_argument, NULL, 'f'},
+        {"format", required_argument, NULL, 'J'},
+        {"help",    no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    long threads = 0;
+    enum pattern pattern = PATTERN_RMW;
+    struct worker_spec* specs = NULL;
+    long num_specs = 0;
+    unsigned long bank_mask = (1u << NUM_BANKS) - 1;
+    unsigned long bank_shift = BANK_SHIFT;
+    unsigned long row_shift = ROW_SHIFT;
+    unsigned long report_ms = 0;
+    const char* report_path = NULL;
+    enum output_format format = FORMAT_TEXT;
+    bool pmu = false;
+    unsigned long sample_lines = 0;
+    double rate = 0;
+    double duty = 0;
+    bool pace_sleep = false;
+    double duration = 0;
+    long fifo = 0;
+    bool lock = false;
+    uint64_t line_override = 0, l2_override = 0;
+    unsigned long prefetch_lines = PREFETCH_LINES;
+    double multiplier = 0; // For the default
+    uint64_t size = 0;
+    uint64_t offset = 0;
+    bool baseline = false;
+    bool victim = false;
+    bool calibrate = false;
+    const char* save_path = NULL;
+    const char* udmabuf = NULL;
+    if (load_config(&argc, &argv) != 0) {
+        perror("Unable to load configuration. Terminating...");
+        return 2;
+    }
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:p:h", long_opts, NULL)) != -1) {
+        char* status = NULL;
+        switch (opt) {
+        case 't':
+            threads = strtol(optarg, &status, 10);
+            if (threads < 1 || status[0] != '\0') {
+                fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            pattern = find_pattern(optarg);
+            if (pattern == NUM_PATTERNS) {
+                fprintf(stderr, "Unknown pattern: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'w': {
+            struct worker_spec* grown = realloc(specs, (num_specs + 1) * sizeof(*specs));
+            if (!grown) {
+                perror("Unable to allocate worker specs. Terminating...");
+                return 2;
+            }
+            specs = grown;
+            if (parse_worker_spec(optarg, &specs[num_specs++]) != 0) {
+                fprintf(stderr, "Invalid worker spec: %s\n", optarg);
+                return 1;
+            }
+            break;
+        }
+        case 'B':
+            bank_mask = strtoul(optarg, &status, 0);
+            if (bank_mask == 0 || bank_mask >> NUM_BANKS || status[0] != '\0') {
+                fprintf(stderr, "Invalid bank mask: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'S':
+        case 'R':
+            *(opt == 'S' ? &bank_shift : &row_shift) = strtoul(optarg, &status, 10);
+            if (status[0] != '\0' || bank_shift > 31 - 3 || row_shift > 31) {
+                fprintf(stderr, "Invalid bit position: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'I':
+            report_ms = strtoul(optarg, &status, 10);
+            if (report_ms == 0 || status[0] != '\0') {
+                fprintf(stderr, "Invalid report interval: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'F':
+            report_path = optarg;
+            break;
+        case 'P':
+            pmu = true;
+            break;
+        case 'V':
+            victim = true;
+            break;
+        case 'c':
+            calibrate = true;
+            break;
+        case 'o':
+            save_path = optarg;
+            break;
+        case 'f':
+            // Already spliced into argv by load_config()
+            break;
+        case 'N':
+            sample_lines = strtoul(optarg, &status, 10);
+            if (sample_lines == 0 || sample_lines > CHUNK_SIZE / MIN_STRIDE || status[0] != '\0') {
+                fprintf(stderr, "Invalid sampling period: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            rate = strtod(optarg, &status);
+            if (rate <= 0 || status[0] != '\0') {
+                fprintf(stderr, "Invalid rate: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd':
+            duty = strtod(optarg, &status);
+            if (duty <= 0 || duty > 100 || status[0] != '\0') {
+                fprintf(stderr, "Invalid duty cycle: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'W':
+            if (strcmp(optarg, "spin") == 0) {
+                pace_sleep = false;
+            } else if (strcmp(optarg, "sleep") == 0) {
+                pace_sleep = true;
+            } else {
+                fprintf(stderr, "Unknown pacing mode: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'T':
+            duration = strtod(optarg, &status);
+            if (duration <= 0 || status[0] != '\0') {
+                fprintf(stderr, "Invalid duration: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'Y': {
+            unsigned long sweeps = strtoul(optarg, &status, 10);
+            double ms = status[0] == ':' ? strtod(status + 1, &status) : 0;
+            if (sweeps == 0 || sweeps > UINT32_MAX || ms <= 0 || status[0] != '\0') {
+                fprintf(stderr, "Bursts must be given as SWEEPS:MILLISECONDS: %s\n", optarg);
+                return 1;
+            }
+            burst_sweeps = sweeps;
+            burst_period_ns = ms * 1e6;
+            break;
+        }
+        case 'Q':
+            fifo = strtol(optarg, &status, 10);
+            if (fifo < sched_get_priority_min(SCHED_FIFO) || fifo > sched_get_priority_max(SCHED_FIFO) ||
+                status[0] != '\0') {
+                fprintf(stderr, "Invalid SCHED_FIFO priority: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'U':
+            lock = true;
+            break;
+        case 'L':
+            if (strcmp(optarg, "page") == 0)
+                line_override = sysconf(_SC_PAGESIZE);
+            else if (parse_size(optarg, &line_override) != 0)
+                line_override = 0;
+            if (line_override == 0 || line_override & (line_override - 1) ||
+                line_override < 16 || line_override > CHUNK_SIZE) {
+                fprintf(stderr, "Line size must be a power of two from 16 to %d: %s\n", CHUNK_SIZE, optarg);
+                return 1;
+            }
+            break;
+        case 'C':
+            if (parse_size(optarg, &l2_override) != 0 || l2_override > UINT32_MAX / 4) {
+                fprintf(stderr, "Invalid cache size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'X':
+            multiplier = strtod(optarg, &status);
+            if (multiplier <= 0 || status[0] != '\0') {
+                fprintf(stderr, "Invalid buffer multiplier: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'Z':
+            if (parse_size(optarg, &size) != 0) {
+                fprintf(stderr, "Invalid buffer size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'O':
+            if (strcmp(optarg, "0") != 0 && (parse_size(optarg, &offset) != 0 || offset > UINT32_MAX / 2)) {
+                fprintf(stderr, "Invalid offset: %s\n", optarg);
+                return 1;
+            }
+            buffer_offset = offset;
+            break;
+        case 'K':
+            for (char* range = optarg; ; range = status + 1) {
+                unsigned long first = strtoul(range, &status, 10), last = first;
+                if (status[0] == '-')
+                    last = strtoul(status + 1, &status, 10);
+                if (status == range || first > last || last >= MAX_COLORS ||
+                    (status[0] != ',' && status[0] != '\0')) {
+                    fprintf(stderr, "Invalid colour list: %s\n", optarg);
+                    return 1;
+                }
+                for (unsigned long c = first; c <= last; c++)
+                    color_mask |= 1ull << c;
+                if (status[0] == '\0')
+                    break;
+            }
+            alloc_mode = ALLOC_COLORED;
+            break;
+        case 'H':
+            alloc_mode = ALLOC_HUGE;
+            break;
+        case 'D':
+            prefetch_lines = strtoul(optarg, &status, 10);
+            if (status[0] != '\0' || prefetch_lines > 1024) {
+                fprintf(stderr, "Invalid prefetch distance: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'A':
+            baseline = true;
+            break;
+        case 'M':
+            phys_base = strtoull(optarg, &status, 0);
+            if (status[0] != ':' || parse_size(status + 1, &phys_size) != 0) {
+                fprintf(stderr, "Physical region must be given as ADDR:SIZE: %s\n", optarg);
+                return 1;
+            }
+            alloc_mode = ALLOC_PHYS;
+            break;
+        case 'G':
+            udmabuf = optarg;
+            alloc_mode = ALLOC_UDMABUF;
+            break;
+        case 'E':
+            if (strcmp(optarg, "nc") == 0) {
+                cache_mode = CACHE_NC;
+            } else if (strcmp(optarg, "wc") == 0) {
+                cache_mode = CACHE_WC;
+            } else {
+                fprintf(stderr, "Invalid cache mode: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'J':
+            if (strcmp(optarg, "text") == 0) {
+                format = FORMAT_TEXT;
+            } else if (strcmp(optarg, "json") == 0) {
+                format = FORMAT_JSON;
+            } else if (strcmp(optarg, "csv") == 0) {
+                format = FORMAT_CSV;
+            } else {
+                fprintf(stderr, "Invalid output format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'h':
+        default:
+            usage(argv[0]);
+            return 1;
+        }
     }
 
     uint32_t iterations = 0;
-    if (argc >= 2) {
+    info = format == FORMAT_TEXT ? stdout : stderr;
+    bool infinite = optind >= argc;
+    if (!infinite) {
         char* status = {'\0'};
-        iterations = strtol(argv[1], &status, 10);
+        iterations = strtol(argv[optind], &status, 10);
         if (iterations == LONG_MIN || iterations == LONG_MAX || status[0] != '\0') {
             perror("Invalid iteration count");
             return 1;
         }
+    } else if (duration) {
+        fprintf(info, "Generating memory bus traffic for %gs...\n", duration);
     } else {
-        fprintf(stdout, "Infinitely generating memory bus traffic...\n");
+        fprintf(info, "Infinitely generating memory bus traffic...\n");
     }
 
-    // Allocate a buffer meaningfully larger than the L2 such that when
-    // iterating through, subsequent access to the same address will miss.
-    // We make it generously larger as the L2 does not use true LRU.
-    uint8_t* buffer = malloc(L2_SIZE * 4);
+    if (size && multiplier) {
+        fprintf(stderr, "Buffers are sized by either --size or --multiplier, not both.\n");
+        return 1;
+    }
+    if (size && calibrate) {
+        fprintf(stderr, "--calibrate tries its own buffer sizes; --size does not apply.\n");
+        return 1;
+    }
+    if (set_geometry(line_override, l2_override, multiplier, size) != 0)
+        return 1;
 
-    if (!buffer) {
-        perror("Unable to allocate buffer. Terminating...");
+    if (alloc_mode == ALLOC_COLORED) {
+        unsigned colors = num_colors();
+        if (colors > MAX_COLORS || color_mask >> (colors - 1) >> 1) {
+            fprintf(stderr, "This cache has %u page colours; at most %d can be selected from.\n",
+                    colors, colors < MAX_COLORS ? colors : MAX_COLORS);
+            return 1;
+        }
+        fprintf(info, "Confining buffers to %d of %u page colours.\n",
+                __builtin_popcountll(color_mask), colors);
+    }
+
+    if (num_specs && threads) {
+        fprintf(stderr, "Workers are given either by --threads or by --worker, not both.\n");
+        return 1;
+    }
+    // Without --threads or --worker, behave as before: one unpinned sweep on
+    // this thread. --threads is the same spec for every worker.
+    bool pin = threads > 0 || num_specs > 0;
+    bool mixed = num_specs > 0;
+    if (!mixed) {
+        num_specs = threads > 0 ? threads : 1;
+        specs = calloc(num_specs, sizeof(*specs));
+        if (!specs) {
+            perror("Unable to allocate worker specs. Terminating...");
+            return 2;
+        }
+        for (long t = 0; t < num_specs; t++)
+            specs[t] = (struct worker_spec){.cpu = -1, .pattern = NUM_PATTERNS};
+    }
+    threads = num_specs;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+    if (threads > cpus)
+        fprintf(stderr, "Warning: %ld threads requested but only %ld cores online. "
+                "Some cores will run more than one worker.\n", threads, cpus);
+
+    // The victim's thrashers and the calibration trials are this program
+    // again, with every option but those that started them. A thrasher beside
+    // the victim runs one unpinned worker that inherits the core it is
+    // started on, until stopped, so --duration only ever sets how long each
+    // calibration trial runs.
+    if (victim || calibrate) {
+        if (pin) {
+            fprintf(stderr, "--%s places its own workers; --threads and --worker do not apply.\n",
+                    calibrate ? "calibrate" : "victim");
+            return 1;
+        }
+        char** args = calloc(optind + 16, sizeof(char*));
+        if (!args) {
+            perror("Unable to allocate thrasher arguments. Terminating...");
+            return 2;
+        }
+        int nargs = 0;
+        for (int i = 0; i < optind; i++) {
+            if (strcmp(argv[i], "--save-config") == 0 || strcmp(argv[i], "--duration") == 0)
+                i++;
+            else if (strcmp(argv[i], "--victim") != 0 && strcmp(argv[i], "--calibrate") != 0 &&
+                     strncmp(argv[i], "--save-config=", strlen("--save-config=")) != 0 &&
+                     strncmp(argv[i], "--duration=", strlen("--duration=")) != 0)
+                args[nargs++] = argv[i];
+        }
+        int ret;
+        if (calibrate) {
+            char seconds[32] = TRIAL_SECONDS;
+            if (duration)
+                snprintf(seconds, sizeof(seconds), "%g", duration);
+            ret = run_calibration(args, nargs, cpus, victim, seconds, save_path);
+        } else {
+            ret = run_victim(args, nargs, cpus, infinite ? VICTIM_RUNS : iterations);
+        }
+        free(args);
+        return ret;
+    }
+
+    if (cache_mode != CACHE_DEFAULT && alloc_mode != ALLOC_PHYS && alloc_mode != ALLOC_UDMABUF) {
+        fprintf(stderr, "--uncached needs buffers from --phys or --udmabuf.\n");
+        return 1;
+    }
+    if (cache_mode == CACHE_WC && alloc_mode == ALLOC_PHYS) {
+        fprintf(stderr, "/dev/mem can only map memory non-cacheable; use --udmabuf for write-combining.\n");
+        return 1;
+    }
+    if (rate && duty) {
+        fprintf(stderr, "Only one of --rate and --duty may be given.\n");
+        return 1;
+    }
+    uint32_t bank_workers = 0;
+    bool all_write = true;
+    for (long t = 0; t < threads; t++) {
+        struct worker_spec* spec = &specs[t];
+        if (spec->pattern == NUM_PATTERNS)
+            spec->pattern = pattern;
+        // Uncached memory is never prefetched into anything, nor dirty
+        if (cache_mode != CACHE_DEFAULT && (spec->pattern == PATTERN_PREFETCH ||
+            spec->pattern == PATTERN_RMW_PREFETCH || spec->pattern == PATTERN_CLEAN)) {
+            fprintf(stderr, "The %s pattern does nothing on uncached memory.\n", kernels[spec->pattern].name);
+            return 1;
+        }
+#ifdef __arm__
+        if (spec->pattern == PATTERN_CLEAN && buffer_size <= l2_size) {
+            fprintf(stderr, "The clean pattern only reaches the outer cache on 32-bit ARM, so a buffer\n"
+                    "that fits in it never writes back to DRAM; use a --multiplier above 1.\n");
+            return 1;
+        }
+#endif
+        if (sample_lines && spec->pattern == PATTERN_BANK) {
+            fprintf(stderr, "The bank pattern issues whole row pairs at a time and cannot be sampled.\n");
+            return 1;
+        }
+        if (buffer_offset && spec->pattern == PATTERN_BANK) {
+            fprintf(stderr, "The bank pattern places its accesses itself; --offset does not apply.\n");
+            return 1;
+        }
+        if (baseline && spec->pattern == PATTERN_CHASE) {
+            fprintf(stderr, "The rmw baseline would corrupt the pointers that chase follows.\n");
+            return 1;
+        }
+        bank_workers += spec->pattern == PATTERN_BANK;
+        all_write &= spec->pattern == PATTERN_WRITE || spec->pattern == PATTERN_RANDOM_WRITE;
+    }
+
+    uint32_t num_banks = __builtin_popcountl(bank_mask);
+    uint32_t row_pairs = buffer_size / (2 * num_banks << row_shift);
+    // The bank pattern touches as many lines as the others, but spread over
+    // every row it needs in each selected bank. Those rows are split between
+    // the bank workers so that they never hit on each other's lines.
+    if (bank_workers) {
+        if (row_shift + 1 >= bank_shift || (1u << row_shift) < line_size || row_pairs == 0) {
+            fprintf(stderr, "Row bits must lie between line bits and bank bits.\n");
+            return 1;
+        }
+        if (2 * row_pairs * bank_workers > 1u << (bank_shift - row_shift)) {
+            fprintf(stderr, "Not enough rows per bank for %u workers.\n", bank_workers);
+            return 1;
+        }
+        // The controller picks banks and rows from physical address bits
+        if (alloc_mode != ALLOC_PHYS && alloc_mode != ALLOC_UDMABUF)
+            fprintf(stderr, "WARNING: Without --phys or --udmabuf, the bank pattern sets its bank and row bits in\n"
+                    "virtual addresses only. Its accesses need not land in the selected banks or rows.\n");
+    }
+
+    // The region must be kept from the kernel with memmap=, mem= or a
+    // no-map reserved-memory node. Mapping RAM the kernel is using would let
+    // the thrasher scribble over it.
+    if (alloc_mode == ALLOC_PHYS &&
+        (devmem_fd = open("/dev/mem", O_RDWR | (cache_mode == CACHE_NC ? O_SYNC : 0))) < 0) {
+        perror("Unable to open /dev/mem. Terminating...");
+        return 2;
+    }
+    if (alloc_mode == ALLOC_UDMABUF && (devmem_fd = udmabuf_open(udmabuf)) < 0) {
+        fprintf(stderr, "Unable to open u-dma-buf device %s: %s. Terminating...\n", udmabuf, strerror(errno));
+        return 2;
+    }
+    // The span is the first piece of the region, so the region's own base
+    // must leave the bank and row bits of every offset in it unchanged
+    if (bank_workers && devmem_fd >= 0 && (phys_base + phys_used) & ((1ull << bank_shift) - 1)) {
+        fprintf(stderr, "The region must start on a %#llx-byte boundary for the bank pattern.\n",
+                1ull << bank_shift);
+        return 1;
+    }
+
+    // Once the buffers outgrow the TLB's reach, pages keep needing table
+    // walks, which go out to DRAM too when the tables do not fit in the L2
+    long page = alloc_mode == ALLOC_HUGE ? HUGE_PAGE_SIZE : sysconf(_SC_PAGESIZE);
+    double footprint = (double)buffer_size * threads;
+    fprintf(info, "Footprint: %.1fMiB in %ld buffer%s, spanning %.0f %ldKiB pages.\n",
+            footprint / (1 << 20), threads, threads > 1 ? "s" : "", footprint / page, page / 1024);
+
+    struct worker* workers = calloc(threads, sizeof(struct worker));
+    if (!workers) {
+        perror("Unable to allocate worker state. Terminating...");
+        free(specs);
         return 2;
     }
 
-    for (uint32_t i = 0; i < iterations || argc == 1; i++) {
-        for (uint32_t i = 0; i < L2_SIZE * 4; i += LINE_SIZE) {
-            buffer[i]++;
+    struct reporter reporter = {
+        .workers = workers,
+        .threads = threads,
+        .interval_ns = report_ms * 1000000ull,
+    };
+
+    // Reserve, but do not commit, every bank up to the highest selected one.
+    // Only the rows actually used are ever faulted in.
+    uint8_t* span = NULL;
+    size_t span_size = (size_t)(32 - __builtin_clz(bank_mask)) << bank_shift;
+    if (bank_workers) {
+        span = alloc_buffer(span_size, true);
+        if (!span) {
+            perror("Unable to reserve address space for bank pattern. Terminating...");
+            free(workers);
+            free(specs);
+            return 2;
+        }
+        // A region piece is located by its extent alone. Elsewhere, only the
+        // start of the span is worth faulting in; the rest is sparse.
+        if (alloc_mode == ALLOC_PHYS || alloc_mode == ALLOC_UDMABUF)
+            report_phys("Bank span", span, span_size);
+        else if (alloc_mode != ALLOC_ANON)
+            report_phys("Bank span", span, 1);
+    }
+
+    int ret = 0;
+    long started = 0, initialized = 0;
+    if (sample_lines) {
+        probe_cycle_counter();
+        fprintf(info, "Timing 1 in %lu accesses %s.\n", sample_lines,
+                have_cycle_counter ? "with the cycle counter" : "with clock_gettime(), as the cycle counter is not accessible");
+    }
+    for (long t = 0, bank_index = 0; t < threads; t++) {
+        struct worker* w = &workers[t];
+        const struct worker_spec* spec = &specs[t];
+        const struct kernel* kernel = &kernels[spec->pattern];
+        w->cpu = spec->cpu >= 0 ? spec->cpu : pin ? t % cpus : -1;
+        w->pattern = spec->pattern;
+        w->run = select_run(kernel);
+        // Only print each worker's kernel when they can differ
+        if (mixed)
+            fprintf(info, "Worker %ld on CPU %d: ", t, w->cpu);
+        if (mixed || t == 0) {
+            // Sampled chunks always run the generic variant
+            if (w->run == kernel->run || sample_lines)
+                fprintf(info, "%s the generic %s kernel.\n", mixed ? "running" : "Running", kernel->name);
+            else
+                fprintf(info, "%s the %s kernel unrolled %dx for %u-byte lines.\n",
+                        mixed ? "running" : "Running", kernel->name, UNROLL, line_size);
+        }
+        w->prefetch_lines = prefetch_lines;
+        // Prefetching is only interesting in comparison to plain loads and stores
+        w->baseline = baseline || w->pattern == PATTERN_PREFETCH || w->pattern == PATTERN_RMW_PREFETCH;
+        w->iterations = iterations;
+        w->infinite = infinite;
+        w->pmu = pmu;
+        w->sample_lines = sample_lines;
+        w->sample_run = kernel->run;
+        if (spec->rate || spec->duty) {
+            w->rate = spec->rate * 1e6;
+            w->duty = spec->duty / 100;
+        } else {
+            w->rate = rate * 1e6 / threads;
+            w->duty = duty / 100;
+        }
+        w->sleep = pace_sleep;
+        w->fifo = fifo;
+        w->seed = (now_ns() ^ t) | 1;
+        if (w->pattern == PATTERN_BANK) {
+            w->buffer = span;
+            for (uint32_t b = 0; b < NUM_BANKS; b++)
+                if (bank_mask & (1u << b))
+                    w->bank_offset[w->num_banks++] = b << bank_shift;
+            w->row_shift = row_shift;
+            w->row_pairs = row_pairs;
+            w->row_base = 2 * row_pairs * bank_index++;
+        } else if (alloc_worker(w, t) != 0) {
+            perror("Unable to allocate buffer. Terminating...");
+            ret = 2;
+            goto out;
+        }
+        if (kernel->init && kernel->init(w) != 0) {
+            fprintf(stderr, "Unable to set up %s pattern: %s. Terminating...\n",
+                    kernel->name, strerror(errno));
+            ret = 2;
+            goto out;
+        }
+        initialized++;
+    }
+
+    // Pages are locked as they are faulted in, so that the sparse bank span
+    // is not committed in full. Workers prefault what they touch anyway.
+    if (lock && mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) != 0)
+        perror("Unable to lock memory. Continuing unlocked");
+
+    // Mask the signals before any thread that would inherit the mask exists
+    struct signaller signaller = {
+        .workers = workers,
+        .threads = threads,
+        .duration_ns = duration * 1e9,
+    };
+    sigemptyset(&signaller.set);
+    sigaddset(&signaller.set, SIGINT);
+    sigaddset(&signaller.set, SIGTERM);
+    sigaddset(&signaller.set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signaller.set, NULL);
+
+    int err;
+    if (report_ms) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&reporter.wake, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_init(&reporter.lock, NULL);
+        // A report file on its own keeps to CSV, as it always has
+        reporter.format = format == FORMAT_JSON ? FORMAT_JSON : FORMAT_CSV;
+        if (!report_path && format != FORMAT_TEXT)
+            reporter.out = stdout;
+        else if (report_path && !(reporter.out = fopen(report_path, "w"))) {
+            perror("Unable to open report file. Terminating...");
+            ret = 2;
+            goto out;
+        }
+        err = pthread_create(&reporter.thread, NULL, report_live, &reporter);
+        if (err) {
+            fprintf(stderr, "Unable to start reporter: %s\n", strerror(err));
+            ret = 2;
+            goto out;
+        }
+    }
+
+    // The PL310 counts traffic from every master, so keep the system quiet
+    const char* l2c_names[2] = {"drreq", "drhit"};
+    if (all_write) {
+        l2c_names[0] = "dwreq";
+        l2c_names[1] = "dwhit";
+    }
+    int l2c_fd[2] = {-1, -1};
+    if (pmu) {
+        for (int e = 0; e < 2; e++) {
+            l2c_fd[e] = l2c_open(l2c_names[e]);
+            if (l2c_fd[e] < 0)
+                fprintf(stderr, "Unable to open PL310 event %s: %s\n", l2c_names[e], strerror(errno));
+        }
+        workers[0].l2c_fd = l2c_fd;
+    }
+
+    err = pthread_create(&signaller.thread, NULL, handle_signals, &signaller);
+    if (err) {
+        fprintf(stderr, "Unable to start signal handling: %s\n", strerror(err));
+        ret = 2;
+        goto out;
+    }
+
+    start_barrier.total = threads;
+    if (threads == 1 && !pin) {
+        thrash(&workers[0]);
+    } else {
+        started = start_workers(workers, threads);
+        if (started < threads)
+            ret = 2;
+        for (long t = 0; t < started; t++)
+            pthread_join(workers[t].thread, NULL);
+    }
+    // The run is timed from when the workers left the barrier together, as
+    // prefaulting, --duty calibration and --baseline come before that
+    uint64_t wall_end = now_ns();
+    uint64_t wall_start = __atomic_load_n(&start_barrier.open_ns, __ATOMIC_ACQUIRE);
+    uint64_t wall_ns = wall_start && wall_start < wall_end ? wall_end - wall_start : 0;
+    pthread_cancel(signaller.thread);
+    pthread_join(signaller.thread, NULL);
+    uint64_t l2c_count[2];
+    for (int e = 0; e < 2; e++) {
+        if (l2c_fd[e] >= 0)
+            ioctl(l2c_fd[e], PERF_EVENT_IOC_DISABLE, 0);
+        l2c_count[e] = perf_read(l2c_fd[e]);
+        if (l2c_fd[e] >= 0)
+            close(l2c_fd[e]);
+    }
+    if (report_ms) {
+        pthread_mutex_lock(&reporter.lock);
+        reporter.done = true;
+        pthread_cond_signal(&reporter.wake);
+        pthread_mutex_unlock(&reporter.lock);
+        pthread_join(reporter.thread, NULL);
+    }
+    if (ret)
+        goto out;
+
+    double total_bytes = 0;
+    for (long t = 0; t < threads; t++)
+        total_bytes += worker_bytes(&workers[t]);
+    if (format != FORMAT_TEXT) {
+        struct run_record record = {
+            .pattern = kernels[workers[0].pattern].name,
+            .workers = workers,
+            .threads = threads,
+            .pinned = pin,
+            .wall_ns = wall_ns,
+            .total_bytes = total_bytes,
+            .pmu = pmu,
+        };
+        for (long t = 1; t < threads; t++)
+            if (workers[t].pattern != workers[0].pattern)
+                record.pattern = "mixed";
+        for (int e = 0; e < 2; e++) {
+            record.l2c_names[e] = l2c_fd[e] >= 0 ? l2c_names[e] : NULL;
+            record.l2c_count[e] = l2c_count[e];
         }
+        if (format == FORMAT_JSON)
+            write_json(stdout, &record);
+        else
+            write_csv(stdout, &record);
+        goto out;
     }
-    // The below math relies on the L2 being at least 256KB
-    double total_kbytes = (L2_SIZE/1024)*4*iterations;
+
+    double total_kbytes = total_bytes / 1024;
     if (total_kbytes/(1<<20) >= 1)
         fprintf(stdout, "Completed generating %.1fGiB of memory requests.\n", total_kbytes/(1<<20));
     else
         fprintf(stdout, "Completed generating %.1fMiB of memory requests.\n", total_kbytes/(1<<10));
 
-    free(buffer);
-    return 0;
+    // Per-access figures are per worker. The total rate is what the memory
+    // system delivered to all workers together over the whole run.
+    for (long t = 0; t < threads; t++) {
+        struct worker* w = &workers[t];
+        char name[32];
+        snprintf(name, sizeof(name), "Worker %ld", t);
+        uint64_t ns = w->elapsed_ns + w->partial_ns;
+        report_rate(name, worker_bytes(w), ns);
+        if (w->baseline && ns)
+            fprintf(stdout, "%s: rmw baseline %.1fMB/s, %s achieved %.2fx that\n", name,
+                    w->baseline_rate / 1e6, kernels[w->pattern].name,
+                    worker_bytes(w) * 1e9 / ns / w->baseline_rate);
+        if (w->sweeps)
+            fprintf(stdout, "%s: %.3fms per iteration (min %.3fms, max %.3fms)\n", name,
+                    (w->elapsed_ns - w->idle_ns) / 1e6 / w->sweeps, w->sweep_min_ns / 1e6, w->sweep_max_ns / 1e6);
+        if (cache_mode != CACHE_DEFAULT && ns)
+            fprintf(stdout, "%s: %.3gM %s transactions/s\n", name,
+                    worker_bytes(w) / access_size() * ops_per_access(w->pattern) * 1e3 / ns,
+                    cache_mode == CACHE_NC ? "uncached" : "write-combined");
+    }
+    if (threads > 1)
+        report_rate("Total", total_bytes, wall_ns);
+
+    for (long t = 0; t < threads; t++) {
+        struct worker* w = &workers[t];
+        if (!w->samples)
+            continue;
+        fprintf(stdout, "Worker %ld latency (%s, %" PRIu64 " samples of 1 in %lu accesses): "
+                "p50 %" PRIu64 ", p99 %" PRIu64 ", p99.9 %" PRIu64 ", max %" PRIu64 "\n",
+                t, timer_unit(), w->samples, sample_lines, hist_percentile(w, 0.5),
+                hist_percentile(w, 0.99), hist_percentile(w, 0.999), w->sample_max);
+    }
+
+    if (pmu) {
+        for (long t = 0; t < threads; t++) {
+            struct worker* w = &workers[t];
+            double accesses = worker_bytes(w) / access_size();
+            fprintf(stdout, "Worker %ld PMU:", t);
+            for (int e = 0; e < NUM_CORE_EVENTS; e++) {
+                const char* sep = e ? "," : "";
+                if (w->pmu_fd[e] < 0)
+                    fprintf(stdout, "%s %s unavailable", sep, core_events[e].name);
+                else if (e == EV_CYCLES || e == EV_INSTRUCTIONS)
+                    fprintf(stdout, "%s %" PRIu64 " %s", sep, w->pmu_count[e], core_events[e].name);
+                else
+                    fprintf(stdout, "%s %.3f %s per access", sep, w->pmu_count[e] / accesses, core_events[e].name);
+            }
+            if (w->pmu_fd[EV_CYCLES] >= 0 && w->pmu_fd[EV_INSTRUCTIONS] >= 0)
+                fprintf(stdout, ", %.2f IPC", (double)w->pmu_count[EV_INSTRUCTIONS] / w->pmu_count[EV_CYCLES]);
+            fprintf(stdout, "\n");
+        }
+        if (l2c_fd[0] >= 0 && l2c_fd[1] >= 0) {
+            double accesses = total_bytes / access_size();
+            fprintf(stdout, "PL310: %" PRIu64 " %s, %" PRIu64 " %s; %.3f misses per access\n",
+                    l2c_count[0], l2c_names[0], l2c_count[1], l2c_names[1],
+                    (l2c_count[0] - l2c_count[1]) / accesses);
+        }
+    }
+
+out:
+    free_workers(workers, threads, initialized);
+    if (reporter.out && reporter.out != stdout)
+        fclose(reporter.out);
+    // Bank workers have no buffer of their own, only the span
+    if (span)
+        free_buffer(span, span_size);
+    free(workers);
+    free(specs);
+    if (devmem_fd >= 0)
+        close(devmem_fd);
+    return ret;
 }
+#endif
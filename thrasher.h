@@ -0,0 +1,38 @@
+/**
+ * Copyright 2019 Joshua Bakita
+ * Description: Interface for running the thrasher inside another program,
+ * e.g. to keep the memory bus busy around a test's own timed region. Link
+ * against libthrasher.a, built with "make lib", and -pthread.
+ * Only one run may be in progress at a time.
+ */
+#ifndef THRASHER_H
+#define THRASHER_H
+#include <stdint.h>
+
+struct thrasher_config {
+    const char* pattern; // Any --pattern but bank, or NULL for rmw
+    int threads; // Workers pinned to cores 0 up, or 0 for one unpinned worker
+    double multiplier; // Buffer size in last-level caches, or 0 for 4
+    uint64_t size; // Or buffer size in bytes, e.g. to reach past the TLB
+    uint32_t line_size; // Or 0 to detect it, as the command line does
+    uint32_t l2_size; // Or 0 to detect it
+    double rate; // MB/s, split between the workers, or 0 for no limit
+    double duty; // Percent of each worker's own peak rate, or 0
+};
+
+struct thrasher_stats {
+    uint64_t ns; // Since the workers started together, up to now or the stop
+    uint64_t sweeps; // Full passes over their buffers, by all workers
+    double bytes; // Swept by all workers
+    double mb_s; // bytes over ns
+};
+
+// Each returns 0, or -1 with errno set. thrasher_start() returns once every
+// worker has set up and started sweeping, and thrasher_stop() once all have
+// stopped, within one 64KiB chunk. Stats remain available after a stop,
+// until the next start.
+int thrasher_start(const struct thrasher_config* config);
+int thrasher_stop(void);
+int thrasher_stats(struct thrasher_stats* stats);
+
+#endif